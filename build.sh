@@ -24,3 +24,12 @@ g++ \
 	src/*.cpp src/server/*.cpp \
 	-lpthread \
 	-o bin/server
+
+g++ \
+	-m64 \
+	-std=c++11 \
+	-I./src \
+	-I./src/replay/ \
+	src/*.cpp src/replay/*.cpp \
+	-lpthread \
+	-o bin/replay
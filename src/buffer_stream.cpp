@@ -0,0 +1,49 @@
+#include "buffer_stream.h"
+#include "util.h"
+#include <stdexcept>
+
+
+void buffer_stream::send(const void *buf, size_t size) {
+    data.append((const char *) buf, size);
+}
+
+
+void buffer_stream::recv(void *buf, size_t size) {
+    if (size > data.size() - pos)
+        throw std::runtime_error("can't receive all data: message is truncated");
+
+    data.copy((char *) buf, size, pos);
+    pos += size;
+}
+
+
+std::string buffer_stream::take_data() {
+    std::string taken;
+    taken.swap(data);
+    pos = 0;
+    return taken;
+}
+
+
+void buffer_stream::clear() {
+    data.clear();
+    pos = 0;
+}
+
+
+void buffer_stream::write_frame(stream_socket *sk) const {
+    send_uint((uint32_t) data.size(), sk);
+    sk->send(data.data(), data.size());
+}
+
+
+void buffer_stream::read_frame(stream_socket *sk) {
+    uint32_t size;
+    recv_uint(size, sk);
+    check_frame_size(size);
+
+    data.resize(size);
+    pos = 0;
+    if (size)
+        sk->recv(&data[0], size);
+}
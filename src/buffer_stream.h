@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stream_socket.h"
+#include <string>
+
+/*
+ * stream_socket over a memory buffer: send appends to the buffer,
+ * recv reads from it and throws if there isn't enough data.
+ * Used to encode a message completely before it goes to a real socket
+ * and to decode a message that has already been received as a whole.
+ */
+class buffer_stream : public stream_socket {
+    std::string data;
+    size_t pos = 0;
+
+public:
+    buffer_stream() {}
+
+    explicit buffer_stream(const std::string &data) : data(data) {}
+
+    void send(const void *buf, size_t size) override;
+
+    void recv(void *buf, size_t size) override;
+
+    const std::string &get_data() const {
+        return data;
+    }
+
+    size_t remaining() const {
+        return data.size() - pos;
+    }
+
+    /*
+     * Moves the contents out, the buffer is left empty.
+     */
+    std::string take_data();
+
+    void clear();
+
+    /*
+     * Frames are sent as a 4-byte length followed by the buffer contents.
+     */
+    void write_frame(stream_socket *sk) const;
+
+    void read_frame(stream_socket *sk);
+};
@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+#include "capture_file.h"
+
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+
+
+capture_writer::capture_writer(const char *path) {
+    file = fopen(path, "wb");
+    if (!file)
+        throw std::runtime_error(std::string("can't create capture file: ") + strerror(errno));
+    setvbuf(file, nullptr, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), file);
+    write_varint(CAPTURE_FORMAT_VERSION);
+    last = std::chrono::steady_clock::now();
+}
+
+
+void capture_writer::write_varint(uint64_t x) {
+    while (x >= 0x80) {
+        fputc((int) (x & 0x7f) | 0x80, file);
+        x >>= 7;
+    }
+    fputc((int) x, file);
+}
+
+
+void capture_writer::write(uint32_t connection, const std::string &packet) {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    /*
+     * время берём под блокировкой, так интервалы между записями не бывают отрицательными
+     */
+    auto now = std::chrono::steady_clock::now();
+    uint64_t delta = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+    last = now;
+
+    write_varint(connection);
+    write_varint(delta);
+    write_varint(packet.size());
+    fwrite(packet.data(), 1, packet.size(), file);
+}
+
+
+capture_writer::~capture_writer() {
+    fclose(file);
+}
+
+
+static bool read_varint(FILE *file, uint64_t &x) {
+    x = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF)
+            return false;
+        x |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    throw std::runtime_error("capture file is damaged: varint is too long");
+}
+
+
+std::vector<capture_record> read_capture(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        throw std::runtime_error(std::string("can't open capture file: ") + strerror(errno));
+
+    std::vector<capture_record> records;
+    try {
+        char magic[sizeof(CAPTURE_MAGIC) - 1];
+        uint64_t version;
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0
+            || !read_varint(file, version))
+            throw std::runtime_error("not a capture file");
+        if (version != CAPTURE_FORMAT_VERSION)
+            throw std::runtime_error("unsupported capture format version");
+
+        uint64_t connection, delta, size, time_us = 0;
+        while (read_varint(file, connection)) {
+            if (!read_varint(file, delta) || !read_varint(file, size))
+                throw std::runtime_error("capture file is truncated");
+
+            capture_record record;
+            record.connection = (uint32_t) connection;
+            time_us += delta;
+            record.time_us = time_us;
+            record.packet.resize(size);
+            if (size > 0 && fread(&record.packet[0], 1, size, file) != size)
+                throw std::runtime_error("capture file is truncated");
+            records.push_back(std::move(record));
+        }
+    } catch (...) {
+        fclose(file);
+        throw;
+    }
+
+    fclose(file);
+    return records;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CAPTURE_MAGIC "TCAP"
+#define CAPTURE_FORMAT_VERSION 1
+
+
+/*
+ * One inbound message of a captured session. An empty packet
+ * marks the end of the session without a bye.
+ */
+struct capture_record {
+    uint32_t connection = 0;
+    uint64_t time_us = 0;
+    std::string packet;
+};
+
+
+/*
+ * Capture file: the magic and the format version, then records of
+ * varint connection id, varint microseconds since the previous record,
+ * varint packet size and the packet as it's sent on the wire.
+ * Varints are LEB128 of up to 64 bits.
+ *
+ * capture_writer is shared by all the sessions, records are appended
+ * in the order they come and buffered, the file is complete
+ * once the writer is destroyed.
+ */
+class capture_writer {
+    FILE *file;
+    std::mutex mtx;
+    std::chrono::steady_clock::time_point last;
+
+    void write_varint(uint64_t x);
+
+public:
+    explicit capture_writer(const char *path);
+
+    capture_writer(const capture_writer &) = delete;
+
+    capture_writer &operator=(const capture_writer &) = delete;
+
+    void write(uint32_t connection, const std::string &packet);
+
+    void write_end(uint32_t connection) {
+        write(connection, std::string());
+    }
+
+    ~capture_writer();
+};
+
+
+/*
+ * Reads a whole capture, record times are made absolute
+ * (microseconds since the capture started). Throws on a damaged file.
+ */
+std::vector<capture_record> read_capture(const char *path);
@@ -2,8 +2,16 @@
 #include "trade_client.h"
 
 static const std::string NEW_LOT = "nl";
+static const std::string NEW_TIMED_LOT = "nt";
 static const std::string LIST_LOTS = "ll";
+static const std::string OPEN_LOTS = "lo";
+static const std::string OWNER_LOTS = "lw";
+static const std::string PRICE_LOTS = "lp";
+static const std::string SEARCH = "s";
+static const uint32_t SEARCH_LIMIT = 100;
 static const std::string LOT_DETAILS = "ld";
+static const std::string AGGREGATE = "a";
+static const std::string AGGREGATE_PER_LOT = "al";
 static const std::string MAKE_BET = "b";
 static const std::string CLOSE_LOT = "c";
 static const std::string QUIT = "q";
@@ -12,8 +20,16 @@ static const std::string HELP = "h";
 static const std::string HELP_MSG =
         "help:\n"
         "nl <description> <price> - new lot\n"
+        "nt <description> <price> <seconds> <extension seconds> - new lot closed by the server after seconds,\n"
+        "    a bet in the last extension seconds extends it\n"
         "ll - list lots\n"
+        "lo - list open lots\n"
+        "lw <owner id> - list lots of an owner\n"
+        "lp <min price> <max price> - list lots with the best price in range\n"
+        "s <words> - search lots having all the words in description, word* is a prefix\n"
         "ld <lot id> - lot details\n"
+        "a <first lot id> <last lot id> - bet statistics of the lots in the id range\n"
+        "al <first lot id> <last lot id> - the same with a line for every lot\n"
         "b <lot id> <new price> - make bet\n"
         "c <lot id> - close lot\n"
         "q - quit\n"
@@ -46,12 +62,32 @@ int main(int argc, char **argv) {
                 description = w1;
                 startPrice = atoi(w2.c_str());
                 tradeClient.newLot(description, startPrice);
+            } else if (cmd == NEW_TIMED_LOT) {
+                std::string w3, w4;
+                std::cin >> w1 >> w2 >> w3 >> w4;
+                description = w1;
+                startPrice = atoi(w2.c_str());
+                tradeClient.newLot(description, startPrice, atoi(w3.c_str()), atoi(w4.c_str()));
             } else if (cmd == LIST_LOTS) {
                 tradeClient.listLots();
+            } else if (cmd == OPEN_LOTS) {
+                tradeClient.queryLots(QueryLotsRequest::OPEN_LOTS);
+            } else if (cmd == OWNER_LOTS) {
+                std::cin >> w1;
+                tradeClient.queryLots(QueryLotsRequest::LOTS_BY_OWNER, atoi(w1.c_str()));
+            } else if (cmd == PRICE_LOTS) {
+                std::cin >> w1 >> w2;
+                tradeClient.queryLots(QueryLotsRequest::LOTS_BY_BEST_PRICE, 0, atoi(w1.c_str()), atoi(w2.c_str()));
+            } else if (cmd == SEARCH) {
+                std::getline(std::cin, w1);
+                tradeClient.search(w1, SEARCH_LIMIT);
             } else if (cmd == LOT_DETAILS) {
                 std::cin >> w1;
                 lotId = atoi(w1.c_str());
                 tradeClient.lotDetails(lotId);
+            } else if (cmd == AGGREGATE || cmd == AGGREGATE_PER_LOT) {
+                std::cin >> w1 >> w2;
+                tradeClient.aggregate(atoi(w1.c_str()), atoi(w2.c_str()), cmd == AGGREGATE_PER_LOT);
             } else if (cmd == MAKE_BET) {
                 std::cin >> w1 >> w2;
                 lotId = atoi(w1.c_str());
@@ -1,36 +1,150 @@
+#include <cstring>
+#include <iterator>
 #include "trade_client.h"
 
-void TradeClient::closeLot(uint32_t lotId) {
-    Packet::constructCloseLotRequest(lotId).writeToStreamSocket(sk);
+
+static stream_client_socket *createSocket(const std::string &addr, tcp_port port) {
+    if (addr.compare(0, strlen(UNIX_ADDR_PREFIX), UNIX_ADDR_PREFIX) == 0)
+        return new unix_client_socket(addr.c_str() + strlen(UNIX_ADDR_PREFIX));
+    if (addr.compare(0, strlen(SHM_ADDR_PREFIX), SHM_ADDR_PREFIX) == 0)
+        return new shm_client_socket(addr.c_str() + strlen(SHM_ADDR_PREFIX));
+
+    size_t colon = addr.find(':');
+    if (colon == std::string::npos)
+        return new tcp_client_socket(addr.c_str(), port);
+    return new tcp_client_socket(addr.substr(0, colon).c_str(), atoi(addr.c_str() + colon + 1));
+}
+
+
+TradeClient::TradeClient(const char *serverAddr, tcp_port port) {
+    std::string addrs(serverAddr);
+    size_t begin = 0;
+
+    while (true) {
+        size_t end = addrs.find(SHARDS_SEPARATOR, begin);
+        shards.push_back(createSocket(addrs.substr(begin, end - begin), port));
+        if (end == std::string::npos)
+            break;
+        begin = end + 1;
+    }
+}
+
+
+bool TradeClient::receive(stream_client_socket *sk) {
     received.readFromStreamSocket(sk);
 
     if (received.getBody()->getType() == Body::BodyType::BYE)
         throw std::runtime_error("server closed");
 
+    if (received.getBody()->getType() == Body::BodyType::REJECTED) {
+        std::cout << "request rejected: " << ((Rejected *) received.getBody())->getReasonText() << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+
+bool TradeClient::receiveConditional(stream_client_socket *sk, uint64_t &version, bool &modified) {
+    if (!receive(sk))
+        return false;
+
+    ResourceVersion *answer = (ResourceVersion *) received.getBody();
+    version = answer->getVersion();
+    modified = answer->isModified();
+    return !modified || receive(sk);
+}
+
+
+/*
+ * Lot and user ids of shard i of n give i modulo n, see LotTable.
+ * Lot ids start from 1, user ids from 0.
+ */
+size_t TradeClient::shardOf(uint32_t id) {
+    return id % shards.size();
+}
+
+
+bool TradeClient::gatherLots(Packet &request, std::list<LotShortInfo> &lots) {
+    for (auto i = shards.begin(); i != shards.end(); ++i)
+        request.writeToStreamSocket(*i);
+
+    /*
+     * ответы читаем со всех шардов, даже если кто-то отказал,
+     * иначе они останутся в сокетах и собьют следующие запросы
+     */
+    bool admitted = true;
+    for (auto i = shards.begin(); i != shards.end(); ++i) {
+        if (!receive(*i)) {
+            admitted = false;
+            continue;
+        }
+        const std::list<LotShortInfo> &shardLots = ((ListLotsResponse *) received.getBody())->getLotsInfo();
+        lots.insert(lots.end(), shardLots.begin(), shardLots.end());
+    }
+
+    return admitted;
+}
+
+
+void TradeClient::closeLot(uint32_t lotId) {
+    stream_client_socket *sk = shards[shardOf(lotId - 1)];
+    Packet::constructCloseLotRequest(lotId).writeToStreamSocket(sk);
+    if (!receive(sk))
+        return;
+
     Status *status = (Status *) received.getBody();
     std::cout << (status->getStatus() ? "closed" : "fail") << '\n';
 }
 
 void TradeClient::makeBet(uint32_t lotId, uint32_t newPrice) {
-    Packet::constructMakeBetRequest(uid, lotId, newPrice).writeToStreamSocket(sk);
-    received.readFromStreamSocket(sk);
-
-    if (received.getBody()->getType() == Body::BodyType::BYE)
-        throw std::runtime_error("server closed");
+    size_t shard = shardOf(lotId - 1);
+    Packet::constructMakeBetRequest(uids[shard], lotId, newPrice).writeToStreamSocket(shards[shard]);
+    if (!receive(shards[shard]))
+        return;
 
     Status *status = (Status *) received.getBody();
     std::cout << (status->getStatus() ? "your bet is accepted" : "fail") << '\n';
 }
 
 void TradeClient::lotDetails(uint32_t lotId) {
-    Packet::constructLotDetailsRequest(lotId).writeToStreamSocket(sk);
-    received.readFromStreamSocket(sk);
-    if (received.getBody()->getType() == Body::BodyType::BYE)
-        throw std::runtime_error("server closed");
+    size_t shard = shardOf(lotId - 1);
+    stream_client_socket *sk = shards[shard];
 
-    LotDetailsResponse *lotDetailsResponse = (LotDetailsResponse *) received.getBody();
-    const LotFullInfo &lotFullInfo = lotDetailsResponse->getLotDetails();
+    if (!isConditional(shard)) {
+        Packet::constructLotDetailsRequest(lotId).writeToStreamSocket(sk);
+        if (receive(sk))
+            printLot(((LotDetailsResponse *) received.getBody())->getLotDetails());
+        return;
+    }
 
+    auto cached = lotCache.find(lotId);
+    uint64_t knownVersion = cached == lotCache.end() ? 0 : cached->second.version;
+    Packet::constructConditionalLotDetailsRequest(lotId, knownVersion).writeToStreamSocket(sk);
+
+    uint64_t version;
+    bool modified;
+    if (!receiveConditional(sk, version, modified)) {
+        lotCache.erase(lotId);
+        return;
+    }
+
+    if (!modified) {
+        if (cached == lotCache.end())
+            throw std::runtime_error("server confirmed an unknown version");
+        printLot(cached->second.info);
+        return;
+    }
+
+    if (cached == lotCache.end() && lotCache.size() >= MAX_CACHED_LOTS)
+        lotCache.clear();
+    CachedLot &entry = lotCache[lotId];
+    entry.version = version;
+    entry.info = ((LotDetailsResponse *) received.getBody())->getLotDetails();
+    printLot(entry.info);
+}
+
+void TradeClient::printLot(const LotFullInfo &lotFullInfo) {
     std::cout << "lot id: " << lotFullInfo.lotId << '\n';
     std::cout << "lot owner id: " << lotFullInfo.ownerId << '\n';
     std::cout << "lot status: " << (lotFullInfo.opened ? "opened" : "closed") << '\n';
@@ -44,16 +158,128 @@ void TradeClient::lotDetails(uint32_t lotId) {
         std::cout << b.customerId << " : " << b.newPrice << '\n';
 }
 
+void TradeClient::aggregate(uint32_t firstLotId, uint32_t lastLotId, bool perLot) {
+    if (perLot && firstLotId <= lastLotId && lastLotId - firstLotId >= MAX_AGGREGATE_LOTS) {
+        std::cout << "at most " << MAX_AGGREGATE_LOTS << " lots can be shown at once\n";
+        return;
+    }
+
+    Packet request = Packet::constructAggregateRequest(firstLotId, lastLotId, perLot);
+    for (auto i = shards.begin(); i != shards.end(); ++i)
+        request.writeToStreamSocket(*i);
+
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (!receive(shards[i]))
+            continue;
+
+        AggregateResponse *response = (AggregateResponse *) received.getBody();
+        const BetAggregate &total = response->getTotal();
+        if (shards.size() > 1)
+            std::cout << "shard " << i << ":\n";
+        std::cout << "bets: " << total.bets << '\n';
+        std::cout << "unique bidders: " << total.uniqueBidders << '\n';
+        std::cout << "price sum: " << total.priceSum << '\n';
+        std::cout << "min price: " << total.minPrice << '\n';
+        std::cout << "max price: " << total.maxPrice << '\n';
+        std::cout << "average price: " << (total.bets ? (double) total.priceSum / total.bets : 0) << '\n';
+        std::cout << "percentiles 50/90/99: " << total.p50 << " " << total.p90 << " " << total.p99 << '\n';
+
+        if (!perLot)
+            continue;
+        std::cout << "lot id | bets | max price | unique bidders\n";
+        for (auto &lot : response->getLots())
+            std::cout << lot.lotId << " : " << lot.bets << " : " << lot.maxPrice << " : " << lot.uniqueBidders << '\n';
+    }
+}
+
+static bool byId(const LotShortInfo &a, const LotShortInfo &b) {
+    return a.lotId < b.lotId;
+}
+
+static bool byBestPrice(const LotShortInfo &a, const LotShortInfo &b) {
+    return a.bestPrice < b.bestPrice || (a.bestPrice == b.bestPrice && a.lotId < b.lotId);
+}
+
 void TradeClient::listLots() {
-    Packet::constructListLotsRequest().writeToStreamSocket(sk);
-    received.readFromStreamSocket(sk);
-    if (received.getBody()->getType() == Body::BodyType::BYE)
-        throw std::runtime_error("server closed");
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (isConditional(i))
+            Packet::constructConditionalListLotsRequest(listings[i].version).writeToStreamSocket(shards[i]);
+        else
+            Packet::constructListLotsRequest().writeToStreamSocket(shards[i]);
+    }
 
-    ListLotsResponse *listLotsResponse = (ListLotsResponse *) received.getBody();
+    /*
+     * как и в gatherLots, читаем ответы всех шардов, даже после отказа
+     */
+    bool admitted = true;
+    std::list<LotShortInfo> lots;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (!isConditional(i)) {
+            if (!receive(shards[i])) {
+                admitted = false;
+                continue;
+            }
+            const std::list<LotShortInfo> &shardLots = ((ListLotsResponse *) received.getBody())->getLotsInfo();
+            lots.insert(lots.end(), shardLots.begin(), shardLots.end());
+            continue;
+        }
 
+        uint64_t version;
+        bool modified;
+        if (!receiveConditional(shards[i], version, modified)) {
+            admitted = false;
+            continue;
+        }
+        if (modified) {
+            listings[i].version = version;
+            listings[i].lots = ((ListLotsResponse *) received.getBody())->getLotsInfo();
+        }
+        lots.insert(lots.end(), listings[i].lots.begin(), listings[i].lots.end());
+    }
+
+    if (!admitted)
+        return;
+
+    lots.sort(byId);
+    printLots(lots);
+}
+
+void TradeClient::queryLots(uint32_t query, uint32_t ownerId, uint32_t minPrice, uint32_t maxPrice) {
+    Packet request = Packet::constructQueryLotsRequest(query, ownerId, minPrice, maxPrice);
+    std::list<LotShortInfo> lots;
+
+    if (query == QueryLotsRequest::LOTS_BY_OWNER) {
+        /*
+         * лоты пользователя есть только на шарде, выдавшем ему id
+         */
+        stream_client_socket *sk = shards[shardOf(ownerId)];
+        request.writeToStreamSocket(sk);
+        if (!receive(sk))
+            return;
+        lots = ((ListLotsResponse *) received.getBody())->getLotsInfo();
+    } else if (!gatherLots(request, lots)) {
+        return;
+    }
+
+    lots.sort(query == QueryLotsRequest::LOTS_BY_BEST_PRICE ? byBestPrice : byId);
+    printLots(lots);
+}
+
+void TradeClient::search(std::string &query, uint32_t limit) {
+    Packet request = Packet::constructSearchRequest(query, limit);
+    std::list<LotShortInfo> lots;
+    if (!gatherLots(request, lots))
+        return;
+
+    lots.sort(byId);
+    if (limit && lots.size() > limit)
+        lots.erase(std::next(lots.begin(), limit), lots.end());
+    printLots(lots);
+}
+
+void TradeClient::printLots(const std::list<LotShortInfo> &lots) {
     std::cout << "lots info:\n";
-    for (auto &a : listLotsResponse->getLotsInfo()) {
+    for (auto &a : lots) {
         std::cout << "lot id: " << a.lotId << '\n';
         std::cout << "status: " << (a.opened ? "open" : "closed") << '\n';
         std::cout << "start price:" << a.startPrice << '\n';
@@ -62,29 +288,45 @@ void TradeClient::listLots() {
     }
 }
 
-void TradeClient::newLot(std::string &description, uint32_t startPrice) {
-    Packet::constructNewLotRequest(description, startPrice).writeToStreamSocket(sk);
-    received.readFromStreamSocket(sk);
+void TradeClient::newLot(std::string &description, uint32_t startPrice, uint32_t duration, uint32_t extension) {
+    stream_client_socket *sk = shards[nextShard];
+    nextShard = (nextShard + 1) % shards.size();
+    Packet::constructNewLotRequest(description, startPrice, duration, extension).writeToStreamSocket(sk);
+    if (!receive(sk))
+        return;
     std::cout << "lot id: " << ((NewLotResponse *) received.getBody())->getLotId() << '\n';
 }
 
 void TradeClient::start() {
-    sk->connect();
+    for (auto sk = shards.begin(); sk != shards.end(); ++sk) {
+        (*sk)->connect();
 
-    received.readFromStreamSocket(sk);
-    if (received.getBody()->getType() == Body::BodyType::BYE)
-        throw std::runtime_error("server closed");
-    AuthorisationResponse* authorisationResponse = (AuthorisationResponse *) received.getBody();
-    uid = authorisationResponse->getId();
-    std::cout << "Connection success! Your id: " << uid << '\n';
+        received.readFromStreamSocket(*sk);
+        if (received.getBody()->getType() == Body::BodyType::BYE)
+            throw std::runtime_error("server closed");
+        AuthorisationResponse* authorisationResponse = (AuthorisationResponse *) received.getBody();
+        uids.push_back(authorisationResponse->getId());
+
+        Packet::constructFeaturesRequest(SUPPORTED_FEATURES).writeToStreamSocket(*sk);
+        received.readFromStreamSocket(*sk);
+        if (received.getBody()->getType() == Body::BodyType::BYE)
+            throw std::runtime_error("server closed");
+        features.push_back(((FeaturesResponse *) received.getBody())->getFeatures());
+    }
+    listings.resize(shards.size());
+
+    std::cout << "Connection success! Your id: " << uids[0];
+    for (size_t i = 1; i < uids.size(); ++i)
+        std::cout << ", " << uids[i];
+    std::cout << '\n';
 }
 
 void TradeClient::bye() {
-    Packet::constructBye().writeToStreamSocket(sk);
+    for (auto sk = shards.begin(); sk != shards.end(); ++sk)
+        Packet::constructBye().writeToStreamSocket(*sk);
 }
 
 TradeClient::~TradeClient() {
-    if (sk) {
-        delete sk;
-    }
+    for (auto sk = shards.begin(); sk != shards.end(); ++sk)
+        delete *sk;
 }
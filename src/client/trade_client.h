@@ -1,26 +1,106 @@
 #pragma once
 
+#include <unordered_map>
 #include "../tcp_socket.h"
+#include "../unix_socket.h"
+#include "../shm_socket.h"
 #include "../server/trade_server.h"
 
+#define UNIX_ADDR_PREFIX "unix:"
+#define SHM_ADDR_PREFIX "shm:"
+
+#define SHARDS_SEPARATOR ','
+
+#define MAX_CACHED_LOTS 4096
+
+
+/*
+ * Client of one server or of several shards of one auction.
+ * A request about a lot goes to the shard owning it, new lots are
+ * spread over the shards in turn, listings are requested from all the
+ * shards at once and merged. The user gets an id on every shard.
+ */
 class TradeClient {
-    uint32_t uid;
+    std::vector<stream_client_socket *> shards;
+    std::vector<uint32_t> uids;
+    std::vector<uint32_t> features;
+    size_t nextShard = 0;
     Packet received;
-    tcp_client_socket *sk = nullptr;
 
-public:
-    TradeClient(const char *serverAddr, tcp_port port = DEFAULT_PORT) {
-        sk = new tcp_client_socket(serverAddr, port);
+    /*
+     * Responses received earlier with their versions. Shards that
+     * agreed to conditional requests send them again only if they
+     * have changed. The lot cache is dropped when it gets full.
+     */
+    struct CachedListing {
+        uint64_t version = 0;
+        std::list<LotShortInfo> lots;
+    };
+
+    struct CachedLot {
+        uint64_t version = 0;
+        LotFullInfo info;
+    };
+
+    std::vector<CachedListing> listings;
+    std::unordered_map<uint32_t, CachedLot> lotCache;
+
+    /*
+     * Reads the response to the last request, throws if the server has
+     * closed the session, returns false if the request was rejected.
+     */
+    bool receive(stream_client_socket *sk);
+
+    /*
+     * Reads the answer to a conditional request, if modified is set
+     * the full response has been read as well.
+     */
+    bool receiveConditional(stream_client_socket *sk, uint64_t &version, bool &modified);
+
+    bool isConditional(size_t shard) {
+        return (features[shard] & FEATURE_CONDITIONAL_REQUESTS) != 0;
     }
 
+    size_t shardOf(uint32_t id);
+
+    /*
+     * Sends the request to every shard, then collects their lists,
+     * so the shards serve it in parallel. Returns false if any rejected it.
+     */
+    bool gatherLots(Packet &request, std::list<LotShortInfo> &lots);
+
+    void printLots(const std::list<LotShortInfo> &lots);
+
+    void printLot(const LotFullInfo &lotFullInfo);
+
+public:
+    /*
+     * serverAddr is a host name or ip for TCP,
+     * "unix:<path>" for a unix socket or "shm:<path>" for shared memory
+     * on the same host (port is ignored then).
+     * Shards are listed separated by commas, a TCP address
+     * may have its own port as "<ip>:<port>".
+     */
+    TradeClient(const char *serverAddr, tcp_port port = DEFAULT_PORT);
+
     void start();
 
-    void newLot(std::string &description, uint32_t startPrice);
+    void newLot(std::string &description, uint32_t startPrice, uint32_t duration = 0, uint32_t extension = 0);
 
     void listLots();
 
+    void queryLots(uint32_t query, uint32_t ownerId = 0, uint32_t minPrice = 0, uint32_t maxPrice = 0);
+
+    void search(std::string &query, uint32_t limit);
+
     void lotDetails(uint32_t lotId);
 
+    /*
+     * Every shard aggregates its own lots, the results are shown
+     * per shard as percentiles can't be merged.
+     */
+    void aggregate(uint32_t firstLotId, uint32_t lastLotId, bool perLot);
+
     void makeBet(uint32_t lotId, uint32_t newPrice);
 
     void closeLot(uint32_t lotId);
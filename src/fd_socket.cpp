@@ -0,0 +1,228 @@
+#include "fd_socket.h"
+#include "util.h"
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+
+
+/*
+ * fd_connection_socket implementation
+ */
+
+fd_connection_socket::fd_connection_socket(int sk) : sk(sk) {}
+
+
+void fd_connection_socket::send(const void *buf, size_t size) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (!fd_send_all(sk, buf, size)) {
+        err_msg = "can't send all data";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+}
+
+
+void fd_connection_socket::recv(void *buf, size_t size) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (!fd_recv_all(sk, buf, size)) {
+        err_msg = "can't receive all data";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+}
+
+
+size_t fd_connection_socket::send_nonblocking(const void *buf, size_t size) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    ssize_t sent = fd_send_nonblocking(sk, buf, size);
+    if (sent < 0) {
+        err_msg = "can't send data";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+
+    return (size_t) sent;
+}
+
+
+bool fd_connection_socket::wait_writable(int timeout_ms) {
+    return fd_wait_writable(sk, timeout_ms);
+}
+
+
+void fd_connection_socket::close() {
+    if (closed)
+        return;
+
+    ::shutdown(sk, SHUT_RDWR);
+    ::close(sk);
+    closed = true;
+}
+
+
+fd_connection_socket::~fd_connection_socket() {
+    if (!closed)
+        ::close(sk);
+}
+
+
+/*
+ * fd_server_socket implementation
+ */
+
+stream_socket *fd_server_socket::make_client(int client_sk) {
+    return new fd_connection_socket(client_sk);
+}
+
+
+void fd_server_socket::shutdown_client(stream_socket *client) {
+    ((fd_connection_socket *) client)->close();
+}
+
+
+stream_socket *fd_server_socket::accept_one_client() {
+    while (true) {
+        int listen_sk;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+
+            if (err_msg) {
+                perror(err_msg);
+                throw std::runtime_error(err_msg);
+            }
+            if (sk < 0)
+                throw std::runtime_error("server socket is closed");
+            listen_sk = sk;
+        }
+
+        int client_sk = accept4(listen_sk, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (client_sk < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd;
+                pfd.fd = listen_sk;
+                pfd.events = POLLIN;
+                if (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+                    continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mtx);
+            err_msg = "can't accept";
+            perror(err_msg);
+            throw std::runtime_error(err_msg);
+        }
+
+        stream_socket *retSocket = make_client(client_sk);
+        if (!retSocket)
+            continue;
+
+        std::unique_lock<std::mutex> lock(mtx);
+        acceptedSockets.push_back(retSocket);
+
+        return retSocket;
+    }
+}
+
+
+void fd_server_socket::release_client(stream_socket *client) {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        acceptedSockets.remove(client);
+    }
+
+    shutdown_client(client);
+    delete client;
+}
+
+
+void fd_server_socket::close() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (sk >= 0) {
+        ::shutdown(sk, SHUT_RDWR);
+        ::close(sk);
+        sk = -1;
+        listener_closed();
+    }
+
+    for (auto i = acceptedSockets.begin(); i != acceptedSockets.end(); ++i)
+        shutdown_client(*i);
+
+    std::cerr << name << " is closed\n";
+}
+
+
+fd_server_socket::~fd_server_socket() {
+    if (sk >= 0)
+        close();
+
+    for (auto i = acceptedSockets.begin(); i != acceptedSockets.end(); ++i)
+        delete *i;
+}
+
+
+/*
+ * fd_client_socket implementation
+ */
+
+fd_client_socket::fd_client_socket(int sk) : sk(sk) {}
+
+
+void fd_client_socket::connect() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (connected) return;
+
+    if (err_msg)
+        throw std::runtime_error(err_msg);
+
+    if (sk < 0) {
+        err_msg = "invalid socket descriptor";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+
+    if (::connect(sk, (sockaddr *) &addr, addr_len) < 0) {
+        err_msg = "can't connect";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+
+    connected = true;
+}
+
+
+void fd_client_socket::send(const void *buf, size_t size) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (!fd_send_all(sk, buf, size)) {
+        err_msg = "can't send all data";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+}
+
+
+void fd_client_socket::recv(void *buf, size_t size) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (!fd_recv_all(sk, buf, size)) {
+        err_msg = "can't receive all data";
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+}
+
+
+fd_client_socket::~fd_client_socket() {
+    if (sk >= 0)
+        ::close(sk);
+}
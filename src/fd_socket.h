@@ -0,0 +1,109 @@
+#pragma once
+
+#include "stream_socket.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <mutex>
+#include <list>
+
+/*
+ * Sockets over a kernel stream descriptor. The transports only create,
+ * bind and connect the descriptor for their address family, the data
+ * and the accept loop go through these classes.
+ */
+
+class fd_connection_socket : public stream_socket {
+    int sk;
+    const char *err_msg = nullptr;
+    std::mutex mtx;
+    bool closed = false;
+
+public:
+    explicit fd_connection_socket(int sk);
+
+    void send(const void *buf, size_t size) override;
+
+    void recv(void *buf, size_t size) override;
+
+    size_t send_nonblocking(const void *buf, size_t size) override;
+
+    bool wait_writable(int timeout_ms) override;
+
+    void close();
+
+    ~fd_connection_socket() override;
+};
+
+
+/*
+ * The listening descriptor is non-blocking: accept_one_client drains
+ * pending connections with accept4 and sleeps in poll only when the
+ * queue is empty.
+ */
+class fd_server_socket : public stream_server_socket {
+    const char *name;
+    std::list<stream_socket *> acceptedSockets;
+
+protected:
+    int sk = -1;
+    const char *err_msg = nullptr;
+    std::mutex mtx;
+
+    /*
+     * Wraps an accepted descriptor, nullptr drops the client and makes
+     * accept_one_client wait for the next one.
+     */
+    virtual stream_socket *make_client(int client_sk);
+
+    /*
+     * Breaks the blocked calls on a client, it's deleted afterwards.
+     */
+    virtual void shutdown_client(stream_socket *client);
+
+    /*
+     * Called under the lock once the listening descriptor is closed.
+     */
+    virtual void listener_closed() {}
+
+public:
+    explicit fd_server_socket(const char *name) : name(name) {}
+
+    stream_socket *accept_one_client() override;
+
+    void release_client(stream_socket *client) override;
+
+    void close() override;
+
+    /*
+     * Subclasses overriding listener_closed close the socket in their own destructor.
+     */
+    ~fd_server_socket() override;
+};
+
+
+class fd_client_socket : public stream_client_socket {
+    const char *err_msg = nullptr;
+    bool connected = false;
+
+protected:
+    int sk;
+    std::mutex mtx;
+    sockaddr_storage addr;
+    socklen_t addr_len = 0;
+
+public:
+    /*
+     * Subclasses fill addr and addr_len for connect.
+     */
+    explicit fd_client_socket(int sk);
+
+    void send(const void *buf, size_t size) override;
+
+    void recv(void *buf, size_t size) override;
+
+    void connect() override;
+
+    ~fd_client_socket() override;
+};
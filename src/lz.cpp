@@ -0,0 +1,149 @@
+#include "lz.h"
+#include <stdint.h>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_HASH_BITS 12
+#define LZ_MAX_RATIO 255
+
+
+static uint32_t read32(const char *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+
+static void putLength(std::string &out, size_t len) {
+    while (len >= 255) {
+        out.push_back((char) 255);
+        len -= 255;
+    }
+    out.push_back((char) len);
+}
+
+
+static void putSequence(std::string &out, const char *literals, size_t literalsLen, size_t offset, size_t matchLen) {
+    size_t matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    uint8_t token = (uint8_t) ((literalsLen < 15 ? literalsLen : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+
+    out.push_back((char) token);
+    if (literalsLen >= 15)
+        putLength(out, literalsLen - 15);
+    out.append(literals, literalsLen);
+
+    if (!matchLen)
+        return;
+
+    out.push_back((char) (offset & 0xff));
+    out.push_back((char) (offset >> 8));
+    if (matchCode >= 15)
+        putLength(out, matchCode - 15);
+}
+
+
+std::string lz_compress(const char *src, size_t size) {
+    std::string out;
+    out.reserve(size + size / 255 + 16);
+
+    /*
+     * позиции хранятся со сдвигом на единицу, 0 значит пустую ячейку
+     */
+    std::vector<size_t> table(1 << LZ_HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    while (pos + LZ_MIN_MATCH <= size) {
+        uint32_t seq = read32(src + pos);
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = pos + 1;
+
+        if (!candidate || pos - (candidate - 1) > LZ_MAX_OFFSET || read32(src + candidate - 1) != seq) {
+            ++pos;
+            continue;
+        }
+
+        size_t ref = candidate - 1;
+        size_t matchLen = LZ_MIN_MATCH;
+        while (pos + matchLen < size && src[ref + matchLen] == src[pos + matchLen])
+            ++matchLen;
+
+        putSequence(out, src + anchor, pos - anchor, pos - ref, matchLen);
+        pos += matchLen;
+        anchor = pos;
+    }
+
+    putSequence(out, src + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+
+static size_t getLength(const uint8_t *&ip, const uint8_t *end) {
+    size_t len = 0;
+    uint8_t b;
+
+    do {
+        if (ip == end)
+            throw std::runtime_error("malformed compressed data");
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+
+    return len;
+}
+
+
+std::string lz_decompress(const char *src, size_t size, size_t rawSize) {
+    if (rawSize > size * LZ_MAX_RATIO + 16)
+        throw std::runtime_error("malformed compressed data");
+
+    std::string out;
+    out.reserve(rawSize);
+
+    const uint8_t *ip = (const uint8_t *) src;
+    const uint8_t *end = ip + size;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literalsLen = token >> 4;
+        if (literalsLen == 15)
+            literalsLen += getLength(ip, end);
+        if (literalsLen > (size_t) (end - ip) || out.size() + literalsLen > rawSize)
+            throw std::runtime_error("malformed compressed data");
+        out.append((const char *) ip, literalsLen);
+        ip += literalsLen;
+
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            throw std::runtime_error("malformed compressed data");
+        size_t offset = ip[0] | (size_t) ip[1] << 8;
+        ip += 2;
+
+        size_t matchLen = token & 0xf;
+        if (matchLen == 15)
+            matchLen += getLength(ip, end);
+        matchLen += LZ_MIN_MATCH;
+
+        if (!offset || offset > out.size() || out.size() + matchLen > rawSize)
+            throw std::runtime_error("malformed compressed data");
+
+        /*
+         * совпадение может перекрывать само себя, поэтому копируем по байту
+         */
+        size_t from = out.size() - offset;
+        for (size_t i = 0; i < matchLen; ++i)
+            out.push_back(out[from + i]);
+    }
+
+    if (out.size() != rawSize)
+        throw std::runtime_error("malformed compressed data");
+
+    return out;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <stddef.h>
+
+/*
+ * Small LZ77 codec in the spirit of the LZ4 block format: a sequence is
+ * a token byte (literals count in the high nibble, match length - 4
+ * in the low one, 15 means the count continues in the next bytes),
+ * the literals, then a 2-byte little endian offset back into the output
+ * and the rest of the match length. The last sequence has only literals.
+ * It is greedy and single-pass, the point is speed, not the best ratio.
+ */
+
+std::string lz_compress(const char *src, size_t size);
+
+/*
+ * Throws std::runtime_error if the data is malformed
+ * or doesn't decompress to exactly rawSize bytes.
+ */
+std::string lz_decompress(const char *src, size_t size, size_t rawSize);
@@ -1,5 +1,8 @@
 #include "protocol.h"
+#include "buffer_stream.h"
+#include "lz.h"
 #include <memory>
+#include <stdexcept>
 
 
 static std::map<Body::BodyType, Serializable *(*)()> constructorTable =
@@ -14,7 +17,23 @@ static std::map<Body::BodyType, Serializable *(*)()> constructorTable =
                 {Body::BodyType::MAKE_BET_REQ,   &MakeBetRequest::generator},
                 {Body::BodyType::CLOSE_LOT_REQ,  &CloseLotRequest::generator},
                 {Body::BodyType::STATUS,         &Status::generator},
-                {Body::BodyType::BYE,            &Bye::generator}
+                {Body::BodyType::BYE,            &Bye::generator},
+                {Body::BodyType::FEATURES_REQ,   &FeaturesRequest::generator},
+                {Body::BodyType::FEATURES_RESP,  &FeaturesResponse::generator},
+                {Body::BodyType::LIST_LOTS_COMPACT_RESP, &ListLotsResponse::compactGenerator},
+                {Body::BodyType::LOT_DET_COMPACT_RESP,   &LotDetailsResponse::compactGenerator},
+                {Body::BodyType::REJECTED,       &Rejected::generator},
+                {Body::BodyType::QUERY_LOTS_REQ, &QueryLotsRequest::generator},
+                {Body::BodyType::SEARCH_REQ,     &SearchRequest::generator},
+                {Body::BodyType::NEW_TIMED_LOT_REQ, &NewLotRequest::timedGenerator},
+                {Body::BodyType::REPLICATE_REQ,     &ReplicateRequest::generator},
+                {Body::BodyType::REPLICATION_BATCH, &ReplicationBatch::generator},
+                {Body::BodyType::CONDITIONAL_LIST_LOTS_REQ, &ListLotsRequest::conditionalGenerator},
+                {Body::BodyType::CONDITIONAL_LOT_DET_REQ,   &LotDetailsRequest::conditionalGenerator},
+                {Body::BodyType::NOT_MODIFIED,              &ResourceVersion::generator},
+                {Body::BodyType::MODIFIED,                  &ResourceVersion::modifiedGenerator},
+                {Body::BodyType::AGGREGATE_REQ,             &AggregateRequest::generator},
+                {Body::BodyType::AGGREGATE_RESP,            &AggregateResponse::generator}
         };
 
 
@@ -24,12 +43,58 @@ void Packet::writeToStreamSocket(stream_socket *sk) {
 }
 
 
+void Packet::writeCompressedToStreamSocket(stream_socket *sk) {
+    buffer_stream raw;
+    writeToStreamSocket(&raw);
+
+    const std::string &data = raw.get_data();
+    if (data.size() >= COMPRESSION_THRESHOLD) {
+        buffer_stream compressed(lz_compress(data.data(), data.size()));
+
+        if (compressed.get_data().size() + 2 * sizeof(uint32_t) < data.size()) {
+            buffer_stream packet;
+            send_uint((uint32_t) Body::BodyType::COMPRESSED, &packet);
+            send_uint((uint32_t) data.size(), &packet);
+            compressed.write_frame(&packet);
+            sk->send(packet.get_data().data(), packet.get_data().size());
+            return;
+        }
+    }
+
+    sk->send(data.data(), data.size());
+}
+
+
 void Packet::readFromStreamSocket(stream_socket *sk) {
     uint32_t t32;
 
     recv_uint(t32, sk);
     Body::BodyType bodyType = (Body::BodyType) t32;
 
+    if (bodyType == Body::BodyType::COMPRESSED) {
+        uint32_t rawSize;
+        recv_uint(rawSize, sk);
+        check_frame_size(rawSize);
+
+        buffer_stream compressed;
+        compressed.read_frame(sk);
+        const std::string &data = compressed.get_data();
+        buffer_stream raw(lz_decompress(data.data(), data.size(), rawSize));
+
+        recv_uint(t32, &raw);
+        bodyType = (Body::BodyType) t32;
+        if (bodyType == Body::BodyType::COMPRESSED)
+            throw std::runtime_error("nested compressed packet");
+
+        readBody(bodyType, &raw);
+        return;
+    }
+
+    readBody(bodyType, sk);
+}
+
+
+void Packet::readBody(Body::BodyType bodyType, stream_socket *sk) {
     if (body)
         delete body;
 
@@ -48,13 +113,13 @@ Packet Packet::constructNewLotResponse(uint32_t lotId) {
 }
 
 
-Packet Packet::constructListLotsResponse(std::list<LotShortInfo> lotsShortInfoList) {
-    return Packet((Body *) new ListLotsResponse(lotsShortInfoList));
+Packet Packet::constructListLotsResponse(std::list<LotShortInfo> lotsShortInfoList, bool compact) {
+    return Packet((Body *) new ListLotsResponse(lotsShortInfoList, compact));
 }
 
 
-Packet Packet::constructLotDetailsResponse(LotFullInfo &info) {
-    return Packet((Body *) new LotDetailsResponse(info));
+Packet Packet::constructLotDetailsResponse(LotFullInfo &info, bool compact) {
+    return Packet((Body *) new LotDetailsResponse(info, compact));
 }
 
 
@@ -63,8 +128,9 @@ Packet Packet::constructStatus(bool closed) {
 }
 
 
-Packet Packet::constructNewLotRequest(std::string description, uint32_t startPrice) {
-    return Packet(new NewLotRequest(description, startPrice));
+Packet Packet::constructNewLotRequest(std::string description, uint32_t startPrice, uint32_t duration,
+                                      uint32_t extension) {
+    return Packet(new NewLotRequest(description, startPrice, duration, extension));
 }
 
 Packet Packet::constructCloseLotRequest(uint32_t lotId) {
@@ -75,14 +141,64 @@ Packet Packet::constructBye() {
     return Packet((Body *) new Bye());
 }
 
+Packet Packet::constructFeaturesRequest(uint32_t features) {
+    return Packet((Body *) new FeaturesRequest(features));
+}
+
+Packet Packet::constructFeaturesResponse(uint32_t features) {
+    return Packet((Body *) new FeaturesResponse(features));
+}
+
+Packet Packet::constructRejected(uint32_t reason) {
+    return Packet((Body *) new Rejected(reason));
+}
+
+Packet Packet::constructQueryLotsRequest(uint32_t query, uint32_t ownerId, uint32_t minPrice, uint32_t maxPrice) {
+    return Packet((Body *) new QueryLotsRequest(query, ownerId, minPrice, maxPrice));
+}
+
+Packet Packet::constructSearchRequest(std::string query, uint32_t limit) {
+    return Packet((Body *) new SearchRequest(query, limit));
+}
+
+
+Packet Packet::constructReplicateRequest(uint64_t from) {
+    return Packet((Body *) new ReplicateRequest(from));
+}
+
+
+Packet Packet::constructReplicationBatch(uint64_t first, std::list<Mutation> mutations) {
+    return Packet((Body *) new ReplicationBatch(first, std::move(mutations)));
+}
+
 Packet Packet::constructListLotsRequest() {
     return Packet(new ListLotsRequest());
 }
 
+Packet Packet::constructConditionalListLotsRequest(uint64_t knownVersion) {
+    return Packet(new ListLotsRequest(true, knownVersion));
+}
+
 Packet Packet::constructLotDetailsRequest(uint32_t lotId) {
     return Packet((Body *) new LotDetailsRequest(lotId));
 }
 
+Packet Packet::constructConditionalLotDetailsRequest(uint32_t lotId, uint64_t knownVersion) {
+    return Packet((Body *) new LotDetailsRequest(lotId, true, knownVersion));
+}
+
+Packet Packet::constructResourceVersion(uint64_t version, bool modified) {
+    return Packet((Body *) new ResourceVersion(version, modified));
+}
+
+Packet Packet::constructAggregateRequest(uint32_t firstLotId, uint32_t lastLotId, bool perLot) {
+    return Packet((Body *) new AggregateRequest(firstLotId, lastLotId, perLot));
+}
+
+Packet Packet::constructAggregateResponse(const BetAggregate &total, std::vector<LotAggregate> lots) {
+    return Packet((Body *) new AggregateResponse(total, std::move(lots)));
+}
+
 Packet Packet::constructMakeBetRequest(uint32_t uid, uint32_t lotId, uint32_t newPrice) {
     return Packet(new MakeBetRequest(uid, lotId, newPrice));
 }
@@ -101,12 +217,20 @@ void AuthorisationResponse::readFromStreamSocket(stream_socket *sk) {
 void NewLotRequest::writeToStreamSocket(stream_socket *sk) {
     send_string(description, sk);
     send_uint(startPrice, sk);
+    if (timed) {
+        send_uint(duration, sk);
+        send_uint(extension, sk);
+    }
 }
 
 
 void NewLotRequest::readFromStreamSocket(stream_socket *sk) {
     description = recv_string(sk);
     recv_uint(startPrice, sk);
+    if (timed) {
+        recv_uint(duration, sk);
+        recv_uint(extension, sk);
+    }
 }
 
 
@@ -117,6 +241,11 @@ void NewLotResponse::readFromStreamSocket(stream_socket *sk) { recv_uint(lotId,
 
 
 void ListLotsResponse::writeToStreamSocket(stream_socket *sk) {
+    if (compact) {
+        writeCompact(sk);
+        return;
+    }
+
     send_uint((uint32_t) lotsInfo.size(), sk);
 
     for (auto i = lotsInfo.begin(); i != lotsInfo.end(); ++i) {
@@ -124,15 +253,22 @@ void ListLotsResponse::writeToStreamSocket(stream_socket *sk) {
         send_bool(i->opened, sk);
         send_uint(i->startPrice, sk);
         send_uint(i->bestPrice, sk);
-        send_string(i->description, sk);
+        TextRef description = i->getDescription();
+        send_string(description.data, description.size, sk);
     }
 }
 
 
 void ListLotsResponse::readFromStreamSocket(stream_socket *sk) {
+    if (compact) {
+        readCompact(sk);
+        return;
+    }
+
     uint32_t lotsInfoSize;
 
     recv_uint(lotsInfoSize, sk);
+    check_list_size(lotsInfoSize);
 
     uint32_t lotId;
     bool opened;
@@ -153,6 +289,59 @@ void ListLotsResponse::readFromStreamSocket(stream_socket *sk) {
 }
 
 
+void ListLotsResponse::writeCompact(stream_socket *sk) {
+    buffer_stream frame;
+    uint32_t prevLotId = 0;
+
+    send_varint((uint32_t) lotsInfo.size(), &frame);
+    for (auto i = lotsInfo.begin(); i != lotsInfo.end(); ++i) {
+        send_varint(zigzag_encode((int32_t) (i->lotId - prevLotId)), &frame);
+        send_bool(i->opened, &frame);
+        send_varint(i->startPrice, &frame);
+        /*
+         * ставки не бывают меньше стартовой цены,
+         * поэтому 0 оставляем для лота без ставок
+         */
+        send_varint(i->bestPrice ? i->bestPrice - i->startPrice + 1 : 0, &frame);
+        TextRef description = i->getDescription();
+        send_compact_string(description.data, description.size, &frame);
+        prevLotId = i->lotId;
+    }
+
+    frame.write_frame(sk);
+}
+
+
+void ListLotsResponse::readCompact(stream_socket *sk) {
+    buffer_stream frame;
+    frame.read_frame(sk);
+
+    uint32_t lotsInfoSize;
+    recv_varint(lotsInfoSize, &frame);
+    check_list_size(lotsInfoSize);
+
+    uint32_t lotId = 0;
+    uint32_t lotIdDelta;
+    bool opened;
+    uint32_t startPrice;
+    uint32_t bestPrice;
+    std::string description;
+
+    for (uint32_t i = 0; i < lotsInfoSize; ++i) {
+        recv_varint(lotIdDelta, &frame);
+        lotId += (uint32_t) zigzag_decode(lotIdDelta);
+        recv_bool(opened, &frame);
+        recv_varint(startPrice, &frame);
+        recv_varint(bestPrice, &frame);
+        if (bestPrice)
+            bestPrice += startPrice - 1;
+        description = recv_compact_string(&frame);
+
+        lotsInfo.push_back(LotShortInfo(lotId, opened, startPrice, bestPrice, description));
+    }
+}
+
+
 void MakeBetRequest::writeToStreamSocket(stream_socket *sk) {
     send_uint(bet.productId, sk);
     send_uint(bet.customerId, sk);
@@ -168,11 +357,17 @@ void MakeBetRequest::readFromStreamSocket(stream_socket *sk) {
 
 
 void LotDetailsResponse::writeToStreamSocket(stream_socket *sk) {
+    if (compact) {
+        writeCompact(sk);
+        return;
+    }
+
     send_uint(lotDetails.lotId, sk);
     send_bool(lotDetails.opened, sk);
     send_uint(lotDetails.ownerId, sk);
     send_uint(lotDetails.startPrice, sk);
-    send_string(lotDetails.description, sk);
+    TextRef description = lotDetails.getDescription();
+    send_string(description.data, description.size, sk);
 
     send_uint((uint32_t) lotDetails.bets.size(), sk);
     for (auto i = lotDetails.bets.begin(); i != lotDetails.bets.end(); ++i) {
@@ -183,6 +378,11 @@ void LotDetailsResponse::writeToStreamSocket(stream_socket *sk) {
 
 
 void LotDetailsResponse::readFromStreamSocket(stream_socket *sk) {
+    if (compact) {
+        readCompact(sk);
+        return;
+    }
+
     uint32_t lotId;
     bool opened;
     uint32_t ownerId;
@@ -197,6 +397,7 @@ void LotDetailsResponse::readFromStreamSocket(stream_socket *sk) {
 
     uint32_t betsLen;
     recv_uint(betsLen, sk);
+    check_list_size(betsLen);
 
     std::list<Bet> bets;
     uint32_t customerId;
@@ -211,6 +412,63 @@ void LotDetailsResponse::readFromStreamSocket(stream_socket *sk) {
 }
 
 
+void LotDetailsResponse::writeCompact(stream_socket *sk) {
+    buffer_stream frame;
+
+    send_varint(lotDetails.lotId, &frame);
+    send_bool(lotDetails.opened, &frame);
+    send_varint(lotDetails.ownerId, &frame);
+    send_varint(lotDetails.startPrice, &frame);
+    TextRef description = lotDetails.getDescription();
+    send_compact_string(description.data, description.size, &frame);
+
+    uint32_t prevPrice = lotDetails.startPrice;
+    send_varint((uint32_t) lotDetails.bets.size(), &frame);
+    for (auto i = lotDetails.bets.begin(); i != lotDetails.bets.end(); ++i) {
+        send_varint(i->customerId, &frame);
+        send_varint(zigzag_encode((int32_t) (i->newPrice - prevPrice)), &frame);
+        prevPrice = i->newPrice;
+    }
+
+    frame.write_frame(sk);
+}
+
+
+void LotDetailsResponse::readCompact(stream_socket *sk) {
+    buffer_stream frame;
+    frame.read_frame(sk);
+
+    uint32_t lotId;
+    bool opened;
+    uint32_t ownerId;
+    uint32_t startPrice;
+    std::string description;
+
+    recv_varint(lotId, &frame);
+    recv_bool(opened, &frame);
+    recv_varint(ownerId, &frame);
+    recv_varint(startPrice, &frame);
+    description = recv_compact_string(&frame);
+
+    uint32_t betsLen;
+    recv_varint(betsLen, &frame);
+    check_list_size(betsLen);
+
+    std::list<Bet> bets;
+    uint32_t customerId;
+    uint32_t priceDelta;
+    uint32_t newPrice = startPrice;
+    for (uint32_t i = 0; i < betsLen; ++i) {
+        recv_varint(customerId, &frame);
+        recv_varint(priceDelta, &frame);
+        newPrice += (uint32_t) zigzag_decode(priceDelta);
+        bets.push_back(Bet(lotId, customerId, newPrice));
+    }
+
+    lotDetails = LotFullInfo(lotId, ownerId, opened, description, startPrice, bets);
+}
+
+
 void CloseLotRequest::writeToStreamSocket(stream_socket *sk) {
     send_uint(lotId, sk);
 }
@@ -240,11 +498,253 @@ bool Status::getStatus() {
 }
 
 
+void ListLotsRequest::writeToStreamSocket(stream_socket *sk) {
+    if (conditional)
+        send_uint64(knownVersion, sk);
+}
+
+
+void ListLotsRequest::readFromStreamSocket(stream_socket *sk) {
+    if (conditional)
+        recv_uint64(knownVersion, sk);
+}
+
+
 void LotDetailsRequest::writeToStreamSocket(stream_socket *sk) {
     send_uint(lotId, sk);
+    if (conditional)
+        send_uint64(knownVersion, sk);
 }
 
 
 void LotDetailsRequest::readFromStreamSocket(stream_socket *sk) {
     recv_uint(lotId, sk);
-}
\ No newline at end of file
+    if (conditional)
+        recv_uint64(knownVersion, sk);
+}
+
+
+void ResourceVersion::writeToStreamSocket(stream_socket *sk) {
+    send_uint64(version, sk);
+}
+
+
+void ResourceVersion::readFromStreamSocket(stream_socket *sk) {
+    recv_uint64(version, sk);
+}
+
+
+void FeaturesRequest::writeToStreamSocket(stream_socket *sk) {
+    send_uint(features, sk);
+}
+
+
+void FeaturesRequest::readFromStreamSocket(stream_socket *sk) {
+    recv_uint(features, sk);
+}
+
+
+void FeaturesResponse::writeToStreamSocket(stream_socket *sk) {
+    send_uint(features, sk);
+}
+
+
+void FeaturesResponse::readFromStreamSocket(stream_socket *sk) {
+    recv_uint(features, sk);
+}
+
+
+void Rejected::writeToStreamSocket(stream_socket *sk) {
+    send_uint(reason, sk);
+}
+
+
+void Rejected::readFromStreamSocket(stream_socket *sk) {
+    recv_uint(reason, sk);
+}
+
+
+const char *Rejected::getReasonText() {
+    switch (reason) {
+        case RATE_LIMITED:
+            return "rate limit exceeded";
+        case UNKNOWN_LOT:
+            return "no such lot";
+        case READ_ONLY:
+            return "server is a read-only follower";
+        case STALE:
+            return "follower is too far behind its primary";
+        case REPLICATION_UNAVAILABLE:
+            return "replication from this position isn't available";
+        case OVER_BUDGET:
+            return "server memory budget is exhausted";
+        case TOO_LARGE:
+            return "message exceeds the size limits";
+        case NOT_A_REQUEST:
+            return "the server doesn't serve messages of this type";
+        default:
+            return "unknown reason";
+    }
+}
+
+
+void QueryLotsRequest::writeToStreamSocket(stream_socket *sk) {
+    send_uint(query, sk);
+    send_uint(ownerId, sk);
+    send_uint(minPrice, sk);
+    send_uint(maxPrice, sk);
+}
+
+
+void QueryLotsRequest::readFromStreamSocket(stream_socket *sk) {
+    recv_uint(query, sk);
+    recv_uint(ownerId, sk);
+    recv_uint(minPrice, sk);
+    recv_uint(maxPrice, sk);
+}
+
+
+void SearchRequest::writeToStreamSocket(stream_socket *sk) {
+    send_string(query, sk);
+    send_uint(limit, sk);
+}
+
+
+void SearchRequest::readFromStreamSocket(stream_socket *sk) {
+    query = recv_string(sk);
+    recv_uint(limit, sk);
+}
+
+
+void ReplicateRequest::writeToStreamSocket(stream_socket *sk) {
+    send_uint64(from, sk);
+}
+
+
+void ReplicateRequest::readFromStreamSocket(stream_socket *sk) {
+    recv_uint64(from, sk);
+}
+
+
+void ReplicationBatch::writeToStreamSocket(stream_socket *sk) {
+    send_uint((uint32_t) (first >> 32), sk);
+    send_uint((uint32_t) first, sk);
+    send_varint((uint32_t) mutations.size(), sk);
+
+    for (auto i = mutations.begin(); i != mutations.end(); ++i) {
+        send_varint(i->type, sk);
+        send_varint(i->lotId, sk);
+        switch (i->type) {
+            case Mutation::NEW_LOT: {
+                send_varint(i->uid, sk);
+                send_varint(i->price, sk);
+                TextRef description = i->getDescription();
+                send_compact_string(description.data, description.size, sk);
+                break;
+            }
+            case Mutation::BET:
+                send_varint(i->uid, sk);
+                send_varint(i->price, sk);
+                send_varint(i->fromEnd, sk);
+                break;
+        }
+    }
+}
+
+
+void ReplicationBatch::readFromStreamSocket(stream_socket *sk) {
+    uint32_t high, low, count;
+    recv_uint(high, sk);
+    recv_uint(low, sk);
+    first = ((uint64_t) high << 32) | low;
+    recv_varint(count, sk);
+    check_list_size(count);
+
+    mutations.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        Mutation mutation;
+        recv_varint(mutation.type, sk);
+        recv_varint(mutation.lotId, sk);
+        switch (mutation.type) {
+            case Mutation::NEW_LOT:
+                recv_varint(mutation.uid, sk);
+                recv_varint(mutation.price, sk);
+                mutation.description = recv_compact_string(sk);
+                break;
+            case Mutation::BET:
+                recv_varint(mutation.uid, sk);
+                recv_varint(mutation.price, sk);
+                recv_varint(mutation.fromEnd, sk);
+                break;
+            case Mutation::CLOSE:
+                break;
+            default:
+                throw std::runtime_error("unknown mutation type");
+        }
+        mutations.push_back(mutation);
+    }
+}
+
+
+void AggregateRequest::writeToStreamSocket(stream_socket *sk) {
+    send_uint(firstLotId, sk);
+    send_uint(lastLotId, sk);
+    send_bool(perLot, sk);
+}
+
+
+void AggregateRequest::readFromStreamSocket(stream_socket *sk) {
+    recv_uint(firstLotId, sk);
+    recv_uint(lastLotId, sk);
+    recv_bool(perLot, sk);
+}
+
+
+void AggregateResponse::writeToStreamSocket(stream_socket *sk) {
+    send_uint64(total.bets, sk);
+    send_uint64(total.priceSum, sk);
+    send_uint(total.minPrice, sk);
+    send_uint(total.maxPrice, sk);
+    send_uint(total.p50, sk);
+    send_uint(total.p90, sk);
+    send_uint(total.p99, sk);
+    send_uint(total.uniqueBidders, sk);
+
+    uint32_t prevLotId = 0;
+    send_varint((uint32_t) lots.size(), sk);
+    for (auto i = lots.begin(); i != lots.end(); ++i) {
+        send_varint(i->lotId - prevLotId, sk);
+        send_varint(i->bets, sk);
+        send_varint(i->maxPrice, sk);
+        send_varint(i->uniqueBidders, sk);
+        prevLotId = i->lotId;
+    }
+}
+
+
+void AggregateResponse::readFromStreamSocket(stream_socket *sk) {
+    recv_uint64(total.bets, sk);
+    recv_uint64(total.priceSum, sk);
+    recv_uint(total.minPrice, sk);
+    recv_uint(total.maxPrice, sk);
+    recv_uint(total.p50, sk);
+    recv_uint(total.p90, sk);
+    recv_uint(total.p99, sk);
+    recv_uint(total.uniqueBidders, sk);
+
+    uint32_t count, lotIdDelta;
+    recv_varint(count, sk);
+    check_list_size(count);
+
+    lots.clear();
+    uint32_t lotId = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        recv_varint(lotIdDelta, sk);
+        lotId += lotIdDelta;
+        LotAggregate lot(lotId);
+        recv_varint(lot.bets, sk);
+        recv_varint(lot.maxPrice, sk);
+        recv_varint(lot.uniqueBidders, sk);
+        lots.push_back(lot);
+    }
+}
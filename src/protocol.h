@@ -11,6 +11,35 @@
 #include "stream_socket.h"
 #include "util.h"
 
+/*
+ * Optional protocol features, negotiated right after authorisation:
+ * the client offers a set of features, the server answers
+ * with the subset it's going to use for the rest of the session.
+ */
+#define FEATURE_COMPACT_ENCODING 0x1
+#define FEATURE_COMPRESSION 0x2
+#define FEATURE_CONDITIONAL_REQUESTS 0x4
+#define SUPPORTED_FEATURES (FEATURE_COMPACT_ENCODING | FEATURE_COMPRESSION | FEATURE_CONDITIONAL_REQUESTS)
+
+/*
+ * Packets smaller than this are never compressed.
+ */
+#define COMPRESSION_THRESHOLD 512
+
+
+/*
+ * Text borrowed from storage that outlives the message referencing it,
+ * lets the server send descriptions without copying them.
+ */
+struct TextRef {
+    const char *data = nullptr;
+    uint32_t size = 0;
+
+    TextRef() {}
+
+    TextRef(const char *data, uint32_t size) : data(data), size(size) {}
+};
+
 
 struct LotShortInfo {
     uint32_t lotId;
@@ -18,6 +47,10 @@ struct LotShortInfo {
     std::string description;
     uint32_t startPrice;
     uint32_t bestPrice;
+    /*
+     * If set, it's sent instead of description.
+     */
+    TextRef descriptionRef;
 
 
     LotShortInfo(uint32_t lotId, bool opened, uint32_t startPrice, uint32_t bestPrice, std::string description) {
@@ -27,6 +60,18 @@ struct LotShortInfo {
         this->bestPrice = bestPrice;
         this->description = description;
     }
+
+    LotShortInfo(uint32_t lotId, bool opened, uint32_t startPrice, uint32_t bestPrice, TextRef descriptionRef) {
+        this->lotId = lotId;
+        this->opened = opened;
+        this->startPrice = startPrice;
+        this->bestPrice = bestPrice;
+        this->descriptionRef = descriptionRef;
+    }
+
+    TextRef getDescription() const {
+        return descriptionRef.data ? descriptionRef : TextRef(description.data(), (uint32_t) description.size());
+    }
 };
 
 
@@ -52,6 +97,10 @@ struct LotFullInfo {
     std::string description;
     uint32_t startPrice;
     std::list<Bet> bets;
+    /*
+     * If set, it's sent instead of description.
+     */
+    TextRef descriptionRef;
 
 
     LotFullInfo() {}
@@ -68,6 +117,11 @@ struct LotFullInfo {
     }
 
 
+    TextRef getDescription() const {
+        return descriptionRef.data ? descriptionRef : TextRef(description.data(), (uint32_t) description.size());
+    }
+
+
     uint32_t getBestPrice() const {
         return (bets.size() > 0
                 ? std::max_element(bets.begin(), bets.end(),
@@ -77,6 +131,61 @@ struct LotFullInfo {
 };
 
 
+/*
+ * Aggregates of the bets of a range of lots. Percentiles are nearest-rank,
+ * bidders are counted by their ids. Prices are 0 when there are no bets.
+ */
+struct BetAggregate {
+    uint64_t bets = 0;
+    uint64_t priceSum = 0;
+    uint32_t minPrice = 0;
+    uint32_t maxPrice = 0;
+    uint32_t p50 = 0;
+    uint32_t p90 = 0;
+    uint32_t p99 = 0;
+    uint32_t uniqueBidders = 0;
+};
+
+
+struct LotAggregate {
+    uint32_t lotId;
+    uint32_t bets = 0;
+    uint32_t maxPrice = 0;
+    uint32_t uniqueBidders = 0;
+
+    LotAggregate(uint32_t lotId = 0) : lotId(lotId) {}
+};
+
+
+/*
+ * One change of the server state as it's replicated to followers.
+ * NEW_LOT: uid is the owner, price is the start price.
+ * BET: uid is the customer, fromEnd is the number of bets
+ * following the new one in the lot's history.
+ * CLOSE: only lotId.
+ */
+struct Mutation {
+    enum Type {
+        NEW_LOT, BET, CLOSE
+    };
+
+    uint32_t type = NEW_LOT;
+    uint32_t lotId = 0;
+    uint32_t uid = 0;
+    uint32_t price = 0;
+    uint32_t fromEnd = 0;
+    std::string description;
+    /*
+     * If set, it's sent instead of description.
+     */
+    TextRef descriptionRef;
+
+    TextRef getDescription() const {
+        return descriptionRef.data ? descriptionRef : TextRef(description.data(), (uint32_t) description.size());
+    }
+};
+
+
 class Serializable {
 public:
     virtual void writeToStreamSocket(stream_socket *sk) = 0;
@@ -99,7 +208,24 @@ public:
         LOT_DET_RESP,
         CLOSE_LOT_REQ,
         STATUS,
-        BYE
+        BYE,
+        FEATURES_REQ,
+        FEATURES_RESP,
+        LIST_LOTS_COMPACT_RESP,
+        LOT_DET_COMPACT_RESP,
+        COMPRESSED,
+        REJECTED,
+        QUERY_LOTS_REQ,
+        SEARCH_REQ,
+        NEW_TIMED_LOT_REQ,
+        REPLICATE_REQ,
+        REPLICATION_BATCH,
+        CONDITIONAL_LIST_LOTS_REQ,
+        CONDITIONAL_LOT_DET_REQ,
+        NOT_MODIFIED,
+        MODIFIED,
+        AGGREGATE_REQ,
+        AGGREGATE_RESP
     };
 
     virtual BodyType getType() = 0;
@@ -111,6 +237,8 @@ public:
 class Packet : public Serializable {
     Body *body = nullptr;
 
+    void readBody(Body::BodyType bodyType, stream_socket *sk);
+
 public:
     Packet() {}
 
@@ -131,27 +259,61 @@ public:
 
     void readFromStreamSocket(stream_socket *sk) override;
 
+    /*
+     * Writes the packet wrapped in a COMPRESSED packet if it's large enough
+     * and compression pays off, otherwise writes it as is.
+     * A COMPRESSED packet carries the raw size and a frame with the compressed
+     * type and body, readFromStreamSocket unwraps it transparently.
+     */
+    void writeCompressedToStreamSocket(stream_socket *sk);
+
     static Packet constructAuthorisationResponse(uint32_t customerId);
 
     static Packet constructNewLotResponse(uint32_t lotId);
 
-    static Packet constructListLotsResponse(std::list<LotShortInfo> lotsShortInfoList);
+    static Packet constructListLotsResponse(std::list<LotShortInfo> lotsShortInfoList, bool compact = false);
 
-    static Packet constructLotDetailsResponse(LotFullInfo &info);
+    static Packet constructLotDetailsResponse(LotFullInfo &info, bool compact = false);
 
     static Packet constructStatus(bool status);
 
-    static Packet constructNewLotRequest(std::string description, uint32_t startPrice);
+    static Packet constructNewLotRequest(std::string description, uint32_t startPrice, uint32_t duration = 0,
+                                         uint32_t extension = 0);
 
     static Packet constructListLotsRequest();
 
+    static Packet constructConditionalListLotsRequest(uint64_t knownVersion);
+
     static Packet constructLotDetailsRequest(uint32_t lotId);
 
+    static Packet constructConditionalLotDetailsRequest(uint32_t lotId, uint64_t knownVersion);
+
+    static Packet constructResourceVersion(uint64_t version, bool modified);
+
+    static Packet constructAggregateRequest(uint32_t firstLotId, uint32_t lastLotId, bool perLot = false);
+
+    static Packet constructAggregateResponse(const BetAggregate &total, std::vector<LotAggregate> lots);
+
     static Packet constructMakeBetRequest(uint32_t uid, uint32_t lotId, uint32_t newPrice);
 
     static Packet constructCloseLotRequest(uint32_t lotId);
 
     static Packet constructBye();
+
+    static Packet constructFeaturesRequest(uint32_t features);
+
+    static Packet constructFeaturesResponse(uint32_t features);
+
+    static Packet constructRejected(uint32_t reason);
+
+    static Packet constructQueryLotsRequest(uint32_t query, uint32_t ownerId = 0,
+                                            uint32_t minPrice = 0, uint32_t maxPrice = 0);
+
+    static Packet constructSearchRequest(std::string query, uint32_t limit);
+
+    static Packet constructReplicateRequest(uint64_t from);
+
+    static Packet constructReplicationBatch(uint64_t first, std::list<Mutation> mutations);
 };
 
 
@@ -175,16 +337,26 @@ public:
 };
 
 
+/*
+ * A timed lot is closed by the server after duration seconds,
+ * a bet in its last extension seconds moves the deadline to extension
+ * seconds after the bet. Lots without a duration are sent as before.
+ */
 class NewLotRequest : public Body {
     std::string description;
     uint32_t startPrice;
+    uint32_t duration = 0;
+    uint32_t extension = 0;
+    bool timed = false;
 
 public:
-    NewLotRequest() {}
+    NewLotRequest(bool timed = false) : timed(timed) {}
 
-    NewLotRequest(std::string description, uint32_t startPrice) : description(description), startPrice(startPrice) {};
+    NewLotRequest(std::string description, uint32_t startPrice, uint32_t duration = 0, uint32_t extension = 0)
+            : description(description), startPrice(startPrice), duration(duration), extension(extension),
+              timed(duration > 0) {};
 
-    BodyType getType() override { return NEW_LOT_REQ; };
+    BodyType getType() override { return timed ? NEW_TIMED_LOT_REQ : NEW_LOT_REQ; };
 
     void writeToStreamSocket(stream_socket *sk) override;
 
@@ -192,9 +364,15 @@ public:
 
     static Serializable *generator() { return (Serializable *) new NewLotRequest(); }
 
+    static Serializable *timedGenerator() { return (Serializable *) new NewLotRequest(true); }
+
     std::string getDescription() { return description; }
 
     uint32_t getStartPrice() { return startPrice; }
+
+    uint32_t getDuration() { return duration; }
+
+    uint32_t getExtension() { return extension; }
 };
 
 
@@ -225,36 +403,67 @@ public:
 };
 
 
+/*
+ * A conditional request carries the version of the listing the client
+ * already has and is answered with ResourceVersion, see there.
+ */
 class ListLotsRequest : public Body {
+    bool conditional = false;
+    uint64_t knownVersion = 0;
+
 public:
+    ListLotsRequest(bool conditional = false, uint64_t knownVersion = 0)
+            : conditional(conditional), knownVersion(knownVersion) {}
+
     BodyType getType() override {
-        return LIST_LOTS_REQ;
+        return conditional ? CONDITIONAL_LIST_LOTS_REQ : LIST_LOTS_REQ;
     }
 
-    void writeToStreamSocket(stream_socket *sk) override {}
+    void writeToStreamSocket(stream_socket *sk) override;
 
-    void readFromStreamSocket(stream_socket *sk) override {}
+    void readFromStreamSocket(stream_socket *sk) override;
 
 
     static Serializable *generator() {
         return (Serializable *) new ListLotsRequest();
     }
+
+    static Serializable *conditionalGenerator() {
+        return (Serializable *) new ListLotsRequest(true);
+    }
+
+    bool isConditional() {
+        return conditional;
+    }
+
+    uint64_t getKnownVersion() {
+        return knownVersion;
+    }
 };
 
 
+/*
+ * In the compact form the whole list goes as one length-prefixed frame
+ * of varints, lot ids are sent as deltas from the previous lot.
+ */
 class ListLotsResponse : public Body {
     std::list<LotShortInfo> lotsInfo;
+    bool compact = false;
+
+    void writeCompact(stream_socket *sk);
+
+    void readCompact(stream_socket *sk);
 
 public:
-    ListLotsResponse() {}
+    ListLotsResponse(bool compact = false) : compact(compact) {}
 
-    ListLotsResponse(std::list<LotShortInfo> lotsInfo) {
+    ListLotsResponse(std::list<LotShortInfo> lotsInfo, bool compact = false) : compact(compact) {
         this->lotsInfo = lotsInfo;
     }
 
 
     BodyType getType() {
-        return BodyType::LIST_LOTS_RESP;
+        return compact ? BodyType::LIST_LOTS_COMPACT_RESP : BodyType::LIST_LOTS_RESP;
     }
 
 
@@ -267,6 +476,10 @@ public:
         return (Serializable *) new ListLotsResponse();
     }
 
+    static Serializable *compactGenerator() {
+        return (Serializable *) new ListLotsResponse(true);
+    }
+
     const std::list<LotShortInfo>& getLotsInfo() {
         return lotsInfo;
     }
@@ -306,18 +519,25 @@ public:
 };
 
 
+/*
+ * A conditional request carries the version of the lot the client
+ * already has and is answered with ResourceVersion, see there.
+ */
 class LotDetailsRequest : Body {
     uint32_t lotId;
+    bool conditional = false;
+    uint64_t knownVersion = 0;
 
 public:
-    LotDetailsRequest() {}
+    LotDetailsRequest(bool conditional = false) : conditional(conditional) {}
 
-    LotDetailsRequest(uint32_t lotId) {
+    LotDetailsRequest(uint32_t lotId, bool conditional = false, uint64_t knownVersion = 0)
+            : conditional(conditional), knownVersion(knownVersion) {
         this->lotId = lotId;
     }
 
     BodyType getType() {
-        return LOT_DET_REQ;
+        return conditional ? CONDITIONAL_LOT_DET_REQ : LOT_DET_REQ;
     }
 
 
@@ -325,6 +545,14 @@ public:
         return lotId;
     }
 
+    bool isConditional() {
+        return conditional;
+    }
+
+    uint64_t getKnownVersion() {
+        return knownVersion;
+    }
+
 
     void writeToStreamSocket(stream_socket *sk) override;
 
@@ -335,22 +563,35 @@ public:
         return (Serializable *) new LotDetailsRequest();
     }
 
+    static Serializable *conditionalGenerator() {
+        return (Serializable *) new LotDetailsRequest(true);
+    }
+
     ~LotDetailsRequest() {}
 };
 
 
+/*
+ * In the compact form the details go as one length-prefixed frame
+ * of varints, every bet price is sent as a delta from the previous one.
+ */
 class LotDetailsResponse : Body {
     LotFullInfo lotDetails;
+    bool compact = false;
+
+    void writeCompact(stream_socket *sk);
+
+    void readCompact(stream_socket *sk);
 
 public:
-    LotDetailsResponse() {}
+    LotDetailsResponse(bool compact = false) : compact(compact) {}
 
-    LotDetailsResponse(LotFullInfo &lotFullInfo) {
+    LotDetailsResponse(LotFullInfo &lotFullInfo, bool compact = false) : compact(compact) {
         lotDetails = lotFullInfo;
     }
 
     BodyType getType() {
-        return LOT_DET_RESP;
+        return compact ? LOT_DET_COMPACT_RESP : LOT_DET_RESP;
     }
 
     void writeToStreamSocket(stream_socket *sk) override;
@@ -361,12 +602,58 @@ public:
         return (Serializable *) new LotDetailsResponse();
     }
 
+    static Serializable *compactGenerator() {
+        return (Serializable *) new LotDetailsResponse(true);
+    }
+
     const LotFullInfo &getLotDetails() {
         return lotDetails;
     }
 };
 
 
+/*
+ * Answer to a conditional request: NOT_MODIFIED if the version the client
+ * knows is the current one, otherwise MODIFIED with the current version,
+ * followed by the usual response. Versions are only compared for equality
+ * and are valid within one server process, so the client has to forget
+ * them when it reconnects. An unknown lot is rejected as usual.
+ */
+class ResourceVersion : Body {
+    uint64_t version = 0;
+    bool modified = false;
+
+public:
+    ResourceVersion(bool modified = false) : modified(modified) {}
+
+    ResourceVersion(uint64_t version, bool modified) : version(version), modified(modified) {}
+
+    BodyType getType() {
+        return modified ? MODIFIED : NOT_MODIFIED;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return (Serializable *) new ResourceVersion();
+    }
+
+    static Serializable *modifiedGenerator() {
+        return (Serializable *) new ResourceVersion(true);
+    }
+
+    uint64_t getVersion() {
+        return version;
+    }
+
+    bool isModified() {
+        return modified;
+    }
+};
+
+
 class CloseLotRequest : Body {
     uint32_t lotId = 0;
 
@@ -439,4 +726,346 @@ public:
     static Serializable *generator() {
         return new Bye();
     }
-};
\ No newline at end of file
+};
+
+
+class FeaturesRequest : Body {
+    uint32_t features = 0;
+
+public:
+    FeaturesRequest() {}
+
+    FeaturesRequest(uint32_t features) {
+        this->features = features;
+    }
+
+    BodyType getType() {
+        return FEATURES_REQ;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new FeaturesRequest();
+    }
+
+    uint32_t getFeatures() {
+        return features;
+    }
+};
+
+
+class FeaturesResponse : Body {
+    uint32_t features = 0;
+
+public:
+    FeaturesResponse() {}
+
+    FeaturesResponse(uint32_t features) {
+        this->features = features;
+    }
+
+    BodyType getType() {
+        return FEATURES_RESP;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new FeaturesResponse();
+    }
+
+    uint32_t getFeatures() {
+        return features;
+    }
+};
+
+
+/*
+ * Sent instead of the response when the server refuses
+ * to process a request, the request has no effect then.
+ * After TOO_LARGE for a message over the decode limits the server
+ * closes the session, as the rest of the message can't be told from
+ * the next one; a request whose response would be over them is just
+ * rejected.
+ */
+class Rejected : Body {
+    uint32_t reason = 0;
+
+public:
+    enum Reason {
+        RATE_LIMITED = 1,
+        UNKNOWN_LOT,
+        READ_ONLY,
+        STALE,
+        REPLICATION_UNAVAILABLE,
+        OVER_BUDGET,
+        TOO_LARGE,
+        NOT_A_REQUEST
+    };
+
+    Rejected() {}
+
+    Rejected(uint32_t reason) {
+        this->reason = reason;
+    }
+
+    BodyType getType() {
+        return REJECTED;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new Rejected();
+    }
+
+    uint32_t getReason() {
+        return reason;
+    }
+
+    const char *getReasonText();
+};
+
+
+/*
+ * Lots selected through a server index, answered with ListLotsResponse.
+ * ownerId is used by LOTS_BY_OWNER, the price range (inclusive)
+ * by LOTS_BY_BEST_PRICE, lots without bets have best price 0.
+ */
+class QueryLotsRequest : Body {
+    uint32_t query = 0;
+    uint32_t ownerId = 0;
+    uint32_t minPrice = 0;
+    uint32_t maxPrice = 0;
+
+public:
+    enum Query {
+        OPEN_LOTS,
+        LOTS_BY_OWNER,
+        LOTS_BY_BEST_PRICE
+    };
+
+    QueryLotsRequest() {}
+
+    QueryLotsRequest(uint32_t query, uint32_t ownerId, uint32_t minPrice, uint32_t maxPrice)
+            : query(query), ownerId(ownerId), minPrice(minPrice), maxPrice(maxPrice) {}
+
+    BodyType getType() {
+        return QUERY_LOTS_REQ;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new QueryLotsRequest();
+    }
+
+    uint32_t getQuery() {
+        return query;
+    }
+
+    uint32_t getOwnerId() {
+        return ownerId;
+    }
+
+    uint32_t getMinPrice() {
+        return minPrice;
+    }
+
+    uint32_t getMaxPrice() {
+        return maxPrice;
+    }
+};
+
+
+/*
+ * Full-text search over descriptions: all the words of the query must
+ * be present, a word ending with '*' is a prefix. Answered with
+ * ListLotsResponse of at most limit lots (0 - no limit) in id order.
+ */
+class SearchRequest : Body {
+    std::string query;
+    uint32_t limit = 0;
+
+public:
+    SearchRequest() {}
+
+    SearchRequest(std::string query, uint32_t limit) : query(query), limit(limit) {}
+
+    BodyType getType() {
+        return SEARCH_REQ;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new SearchRequest();
+    }
+
+    const std::string &getQuery() {
+        return query;
+    }
+
+    uint32_t getLimit() {
+        return limit;
+    }
+};
+
+
+/*
+ * Turns the session into a replication stream: the server answers
+ * with ReplicationBatch messages of its mutations starting from
+ * the one numbered from (0 is the first), and keeps sending new ones.
+ */
+class ReplicateRequest : Body {
+    uint64_t from = 0;
+
+public:
+    ReplicateRequest() {}
+
+    ReplicateRequest(uint64_t from) : from(from) {}
+
+    BodyType getType() {
+        return REPLICATE_REQ;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new ReplicateRequest();
+    }
+
+    uint64_t getFrom() {
+        return from;
+    }
+};
+
+
+/*
+ * Consecutive mutations starting from the one numbered first,
+ * an empty batch is a heartbeat. Encoded with varints.
+ */
+class ReplicationBatch : Body {
+    uint64_t first = 0;
+    std::list<Mutation> mutations;
+
+public:
+    ReplicationBatch() {}
+
+    ReplicationBatch(uint64_t first, std::list<Mutation> mutations) : first(first), mutations(std::move(mutations)) {}
+
+    BodyType getType() {
+        return REPLICATION_BATCH;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new ReplicationBatch();
+    }
+
+    uint64_t getFirst() {
+        return first;
+    }
+
+    const std::list<Mutation> &getMutations() {
+        return mutations;
+    }
+};
+
+
+/*
+ * Aggregates of the bets of lots with ids in [firstLotId, lastLotId]
+ * computed by the server over one snapshot, answered with
+ * AggregateResponse. With perLot it also has a row for every lot
+ * of the range with bets, such a range may cover at most
+ * MAX_AGGREGATE_LOTS ids so that the rows fit the default decode
+ * limits, wider ones are rejected as TOO_LARGE.
+ */
+#define MAX_AGGREGATE_LOTS (1u << 16)
+
+class AggregateRequest : Body {
+    uint32_t firstLotId = 0;
+    uint32_t lastLotId = 0;
+    bool perLot = false;
+
+public:
+    AggregateRequest() {}
+
+    AggregateRequest(uint32_t firstLotId, uint32_t lastLotId, bool perLot)
+            : firstLotId(firstLotId), lastLotId(lastLotId), perLot(perLot) {}
+
+    BodyType getType() {
+        return AGGREGATE_REQ;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new AggregateRequest();
+    }
+
+    uint32_t getFirstLotId() {
+        return firstLotId;
+    }
+
+    uint32_t getLastLotId() {
+        return lastLotId;
+    }
+
+    bool isPerLot() {
+        return perLot;
+    }
+};
+
+
+/*
+ * Lot rows go as varints, lot ids as deltas from the previous row.
+ */
+class AggregateResponse : Body {
+    BetAggregate total;
+    std::vector<LotAggregate> lots;
+
+public:
+    AggregateResponse() {}
+
+    AggregateResponse(const BetAggregate &total, std::vector<LotAggregate> lots)
+            : total(total), lots(std::move(lots)) {}
+
+    BodyType getType() {
+        return AGGREGATE_RESP;
+    }
+
+    void writeToStreamSocket(stream_socket *sk) override;
+
+    void readFromStreamSocket(stream_socket *sk) override;
+
+    static Serializable *generator() {
+        return new AggregateResponse();
+    }
+
+    const BetAggregate &getTotal() {
+        return total;
+    }
+
+    const std::vector<LotAggregate> &getLots() {
+        return lots;
+    }
+};
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string.h>
+#include <thread>
+#include "../buffer_stream.h"
+#include "../capture_file.h"
+#include "../server/trade_server.h"
+
+static const char *USAGE =
+        "usage: replay <capture> [ip] [port] [options]\n"
+        "replays the sessions recorded by a server started with --capture,\n"
+        "every session on its own connection, preserving the order of its requests\n"
+        "--speed=<n> - replay n times faster than recorded, 1 by default\n"
+        "--max - send every request as soon as the previous answer arrives\n";
+
+static const std::map<uint32_t, const char *> REQUEST_NAMES = {
+        {Body::BodyType::NEW_LOT_REQ,               "new lot"},
+        {Body::BodyType::NEW_TIMED_LOT_REQ,         "new timed lot"},
+        {Body::BodyType::LIST_LOTS_REQ,             "list"},
+        {Body::BodyType::CONDITIONAL_LIST_LOTS_REQ, "conditional list"},
+        {Body::BodyType::LOT_DET_REQ,               "details"},
+        {Body::BodyType::CONDITIONAL_LOT_DET_REQ,   "conditional details"},
+        {Body::BodyType::MAKE_BET_REQ,              "bet"},
+        {Body::BodyType::CLOSE_LOT_REQ,             "close"},
+        {Body::BodyType::QUERY_LOTS_REQ,            "query"},
+        {Body::BodyType::SEARCH_REQ,                "search"},
+        {Body::BodyType::FEATURES_REQ,              "features"},
+        {Body::BodyType::AGGREGATE_REQ,             "aggregate"},
+};
+
+
+struct ReplayConfig {
+    const char *capturePath = nullptr;
+    const char *ip = DEFAULT_ADDR;
+    tcp_port port = DEFAULT_PORT;
+    /*
+     * 0 - as fast as possible.
+     */
+    double speed = 1;
+};
+
+
+/*
+ * Latencies in microseconds by request type.
+ */
+struct SessionResult {
+    std::map<uint32_t, std::vector<uint64_t>> latencies;
+    uint64_t rejected = 0;
+    bool failed = false;
+};
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static uint32_t packetType(const std::string &packet) {
+    buffer_stream header(packet.substr(0, sizeof(uint32_t)));
+    uint32_t type;
+    recv_uint(type, &header);
+    return type;
+}
+
+
+static void replaySession(const ReplayConfig &config, const std::vector<const capture_record *> &records,
+                          Clock::time_point start, SessionResult &result) {
+    if (config.speed > 0)
+        std::this_thread::sleep_until(
+                start + std::chrono::microseconds((uint64_t) (records.front()->time_us / config.speed)));
+
+    try {
+        tcp_client_socket sk(config.ip, config.port);
+        sk.connect();
+
+        Packet received;
+        received.readFromStreamSocket(&sk);
+        if (received.getBody()->getType() != Body::BodyType::AUTH_RESP)
+            throw std::runtime_error("server refused the session");
+
+        for (auto i = records.begin(); i != records.end(); ++i) {
+            const capture_record *record = *i;
+            if (record->packet.empty())
+                break;
+
+            if (config.speed > 0)
+                std::this_thread::sleep_until(
+                        start + std::chrono::microseconds((uint64_t) (record->time_us / config.speed)));
+
+            /*
+             * после запроса репликации сессия становится потоком изменений,
+             * это не нагрузка клиентов, дальше её не воспроизводим
+             */
+            uint32_t type = packetType(record->packet);
+            if (type == Body::BodyType::REPLICATE_REQ)
+                break;
+
+            auto sent = Clock::now();
+            sk.send(record->packet.data(), record->packet.size());
+            if (type == Body::BodyType::BYE)
+                break;
+
+            received.readFromStreamSocket(&sk);
+            if (received.getBody()->getType() == Body::BodyType::MODIFIED)
+                received.readFromStreamSocket(&sk);
+            if (received.getBody()->getType() == Body::BodyType::BYE)
+                throw std::runtime_error("server closed the session");
+
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sent);
+            result.latencies[type].push_back(latency.count());
+            if (received.getBody()->getType() == Body::BodyType::REJECTED)
+                ++result.rejected;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "session " << records.front()->connection << ": " << e.what() << '\n';
+        result.failed = true;
+    }
+}
+
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+
+static void printLatencies(const char *name, std::vector<uint64_t> &latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << name << ": " << latencies.size() << " requests, latency us"
+              << " p50 " << percentile(latencies, 0.5)
+              << " p90 " << percentile(latencies, 0.9)
+              << " p99 " << percentile(latencies, 0.99)
+              << " max " << latencies.back() << '\n';
+}
+
+
+static void report(std::vector<SessionResult> &results, double seconds, uint64_t capturedUs) {
+    std::map<uint32_t, std::vector<uint64_t>> byType;
+    std::vector<uint64_t> all;
+    uint64_t rejected = 0;
+    size_t failed = 0;
+
+    for (auto r = results.begin(); r != results.end(); ++r) {
+        for (auto t = r->latencies.begin(); t != r->latencies.end(); ++t) {
+            byType[t->first].insert(byType[t->first].end(), t->second.begin(), t->second.end());
+            all.insert(all.end(), t->second.begin(), t->second.end());
+        }
+        rejected += r->rejected;
+        failed += r->failed;
+    }
+
+    std::cout << results.size() << " sessions (" << failed << " failed) replayed in " << seconds
+              << " s, captured in " << capturedUs / 1e6 << " s\n";
+    if (all.empty())
+        return;
+
+    std::cout << all.size() / seconds << " requests/s, " << rejected << " rejected\n";
+    printLatencies("all", all);
+    for (auto t = byType.begin(); t != byType.end(); ++t) {
+        auto name = REQUEST_NAMES.find(t->first);
+        printLatencies(name != REQUEST_NAMES.end() ? name->second : "other", t->second);
+    }
+}
+
+
+static bool parseConfig(int argc, char **argv, ReplayConfig &config) {
+    int positional = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (positional == 0)
+                config.capturePath = argv[i];
+            else if (positional == 1)
+                config.ip = argv[i];
+            else if (positional == 2)
+                config.port = atoi(argv[i]);
+            else
+                return false;
+            ++positional;
+        } else if (strncmp(argv[i], "--speed=", strlen("--speed=")) == 0) {
+            config.speed = atof(argv[i] + strlen("--speed="));
+            if (config.speed <= 0)
+                return false;
+        } else if (strcmp(argv[i], "--max") == 0) {
+            config.speed = 0;
+        } else {
+            return false;
+        }
+    }
+
+    return config.capturePath != nullptr;
+}
+
+
+int main(int argc, char **argv) {
+    ReplayConfig config;
+    if (!parseConfig(argc, argv, config)) {
+        std::cerr << USAGE;
+        return 1;
+    }
+
+    std::vector<capture_record> records;
+    try {
+        records = read_capture(config.capturePath);
+    } catch (std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    /*
+     * записи разных сессий перемешаны, порядок внутри сессии сохраняется
+     */
+    std::map<uint32_t, std::vector<const capture_record *>> sessions;
+    for (auto i = records.begin(); i != records.end(); ++i)
+        sessions[i->connection].push_back(&*i);
+
+    std::vector<SessionResult> results(sessions.size());
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+
+    size_t n = 0;
+    for (auto s = sessions.begin(); s != sessions.end(); ++s, ++n)
+        threads.emplace_back(replaySession, std::cref(config), std::cref(s->second), start, std::ref(results[n]));
+    for (auto t = threads.begin(); t != threads.end(); ++t)
+        t->join();
+
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    report(results, elapsed.count(), records.empty() ? 0 : records.back().time_us);
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <stdexcept>
+#include "bet_columns.h"
+#include "bet_kernels.h"
+
+/*
+ * Customers are counted in a bitmap of at most this many bits,
+ * larger ids take a pass over the columns for every window of ids.
+ */
+#define BIDDERS_WINDOW (1u << 28)
+
+/*
+ * When a range selects at most 1/SELECTIVE_RANGE of the rows, and not
+ * more than MAX_SELECTED_ROWS, they are copied out once and aggregated
+ * in memory instead of scanning the columns again for every aggregate.
+ */
+#define SELECTIVE_RANGE 64
+#define MAX_SELECTED_ROWS (1u << 20)
+
+/*
+ * Bidders of lots are counted by sorting (lot, customer) pairs of
+ * a block of lots with at most this many bets at a time.
+ */
+#define LOT_BLOCK_ROWS (1u << 22)
+
+#define HISTOGRAM_BUCKETS (1u << 16)
+
+static const unsigned PERCENTS[] = {50, 90, 99};
+static const int PERCENTS_COUNT = sizeof(PERCENTS) / sizeof(PERCENTS[0]);
+
+
+/*
+ * Nearest rank, counted from 1.
+ */
+static uint64_t percentileRank(uint64_t bets, unsigned percent) {
+    uint64_t rank = (bets * percent + 99) / 100;
+    return rank ? rank : 1;
+}
+
+
+BetColumns::BetColumns() : count(0) {
+    for (uint32_t i = 0; i < MAX_CHUNKS; ++i)
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+
+BetColumns::~BetColumns() {
+    for (uint32_t i = 0; i < MAX_CHUNKS; ++i)
+        delete chunks[i].load(std::memory_order_relaxed);
+}
+
+
+void BetColumns::append(uint32_t lotId, uint32_t customerId, uint32_t price) {
+    size_t row = count.load(std::memory_order_relaxed);
+    size_t chunk = row >> CHUNK_BITS;
+
+    if (chunk >= MAX_CHUNKS)
+        throw std::length_error("bet columns are full");
+
+    if (!chunks[chunk].load(std::memory_order_relaxed))
+        chunks[chunk].store(new Chunk, std::memory_order_release);
+
+    Chunk &stored = *chunks[chunk].load(std::memory_order_relaxed);
+    stored.lots[row & (CHUNK_SIZE - 1)] = lotId;
+    stored.customers[row & (CHUNK_SIZE - 1)] = customerId;
+    stored.prices[row & (CHUNK_SIZE - 1)] = price;
+
+    count.store(row + 1, std::memory_order_release);
+}
+
+
+bool BetColumns::aggregate(uint32_t firstLotId, uint32_t lastLotId, BetAggregate &result,
+                           std::vector<LotAggregate> *perLot, MemoryBudget *budget) const {
+    result = BetAggregate();
+    if (perLot)
+        perLot->clear();
+    if (firstLotId > lastLotId)
+        return true;
+
+    /*
+     * все проходы идут по одному и тому же числу строк,
+     * дописанные во время запроса ставки в ответ не попадают
+     */
+    size_t rows = size();
+
+    PriceStats stats;
+    forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+        scanPrices(chunk.lots, chunk.prices, chunk.customers, n, firstLotId, lastLotId, stats);
+    });
+    if (stats.count == 0)
+        return true;
+
+    /*
+     * вся временная память запроса оценивается заранее,
+     * гистограмма и битовая карта считаются вместе, хотя живут по очереди
+     */
+    bool selective = stats.count <= rows / SELECTIVE_RANGE && stats.count <= MAX_SELECTED_ROWS;
+    size_t scratch;
+    if (selective) {
+        scratch = stats.count * (sizeof(Row) + sizeof(uint32_t));
+    } else {
+        size_t bitmapBits = std::min((size_t) stats.maxCustomer + 1, (size_t) BIDDERS_WINDOW);
+        scratch = HISTOGRAM_BUCKETS * sizeof(uint64_t) + (bitmapBits / 64 + 1) * sizeof(uint64_t);
+        if (perLot)
+            scratch += ((size_t) (lastLotId - firstLotId) + 1) * sizeof(LotAggregate)
+                       + std::min(stats.count, (uint64_t) LOT_BLOCK_ROWS) * sizeof(uint64_t);
+    }
+    if (budget && !budget->tryCharge(MemoryLimits::REQUESTS, scratch))
+        return false;
+    MemoryBudget::Charge scratchCharge(budget, MemoryLimits::REQUESTS, scratch);
+
+    result.bets = stats.count;
+    result.priceSum = stats.sum;
+    result.minPrice = stats.minPrice;
+    result.maxPrice = stats.maxPrice;
+
+    if (selective) {
+        std::vector<Row> selected;
+        selected.reserve(stats.count);
+        selectRows(rows, firstLotId, lastLotId, selected);
+        aggregateSelected(selected, result);
+        if (perLot)
+            aggregateLots(selected, *perLot);
+    } else {
+        percentiles(rows, firstLotId, lastLotId, stats.count, result);
+        result.uniqueBidders = countBidders(rows, firstLotId, lastLotId, stats.maxCustomer);
+        if (perLot)
+            aggregateLotRange(rows, firstLotId, lastLotId, stats.maxCustomer, *perLot);
+    }
+
+    return true;
+}
+
+
+void BetColumns::selectRows(size_t rows, uint32_t firstLotId, uint32_t lastLotId, std::vector<Row> &selected) const {
+    forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            if (chunk.lots[i] - firstLotId <= lastLotId - firstLotId)
+                selected.push_back(Row{chunk.lots[i], chunk.customers[i], chunk.prices[i]});
+        }
+    });
+}
+
+
+/*
+ * Percentiles and bidders of rows already copied out, by the same
+ * nearest-rank rule as the scans.
+ */
+void BetColumns::aggregateSelected(std::vector<Row> &selected, BetAggregate &result) {
+    uint32_t *values[] = {&result.p50, &result.p90, &result.p99};
+
+    std::vector<uint32_t> column(selected.size());
+    for (size_t i = 0; i < selected.size(); ++i)
+        column[i] = selected[i].price;
+
+    for (int i = 0; i < PERCENTS_COUNT; ++i) {
+        auto nth = column.begin() + (percentileRank(column.size(), PERCENTS[i]) - 1);
+        std::nth_element(column.begin(), nth, column.end());
+        *values[i] = *nth;
+    }
+
+    for (size_t i = 0; i < selected.size(); ++i)
+        column[i] = selected[i].customerId;
+    std::sort(column.begin(), column.end());
+    result.uniqueBidders = (uint32_t) (std::unique(column.begin(), column.end()) - column.begin());
+}
+
+
+/*
+ * Nearest-rank percentiles in two passes of 65536-bucket histograms:
+ * the high halves of prices find the bucket of every rank,
+ * then the low halves within that bucket find the price.
+ */
+void BetColumns::percentiles(size_t rows, uint32_t firstLotId, uint32_t lastLotId, uint64_t bets,
+                             BetAggregate &result) const {
+    uint32_t *values[] = {&result.p50, &result.p90, &result.p99};
+
+    std::vector<uint64_t> buckets(HISTOGRAM_BUCKETS);
+    forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+        histogramHigh(chunk.lots, chunk.prices, n, firstLotId, lastLotId, buckets.data());
+    });
+
+    uint32_t highs[PERCENTS_COUNT];
+    uint64_t ranks[PERCENTS_COUNT];
+    for (int i = 0; i < PERCENTS_COUNT; ++i) {
+        ranks[i] = percentileRank(bets, PERCENTS[i]);
+        uint32_t high = 0;
+        while (ranks[i] > buckets[high])
+            ranks[i] -= buckets[high++];
+        highs[i] = high;
+    }
+
+    for (int i = 0; i < PERCENTS_COUNT; ++i) {
+        /*
+         * соседние ранги обычно в одной корзине, тогда гистограмма уже посчитана
+         */
+        if (i == 0 || highs[i] != highs[i - 1]) {
+            std::fill(buckets.begin(), buckets.end(), 0);
+            forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+                histogramLow(chunk.lots, chunk.prices, n, firstLotId, lastLotId, highs[i], buckets.data());
+            });
+        }
+
+        uint64_t rank = ranks[i];
+        uint32_t low = 0;
+        while (rank > buckets[low])
+            rank -= buckets[low++];
+        *values[i] = (highs[i] << 16) | low;
+    }
+}
+
+
+uint32_t BetColumns::countBidders(size_t rows, uint32_t firstLotId, uint32_t lastLotId, uint32_t maxCustomer) const {
+    uint32_t bits = (uint32_t) std::min((uint64_t) maxCustomer + 1, (uint64_t) BIDDERS_WINDOW);
+    std::vector<uint64_t> bitmap(bits / 64 + 1);
+    uint32_t bidders = 0;
+
+    for (uint64_t firstCustomer = 0; firstCustomer <= maxCustomer; firstCustomer += BIDDERS_WINDOW) {
+        std::fill(bitmap.begin(), bitmap.end(), 0);
+        forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+            markCustomers(chunk.lots, chunk.customers, n, firstLotId, lastLotId, (uint32_t) firstCustomer, bits,
+                          bitmap.data());
+        });
+
+        for (auto i = bitmap.begin(); i != bitmap.end(); ++i)
+            bidders += __builtin_popcountll(*i);
+    }
+    return bidders;
+}
+
+
+/*
+ * Bets and the best price of every lot of the range in one pass,
+ * then bidders by blocks of lots, see LOT_BLOCK_ROWS. A lot with
+ * more bets than a block has its bidders counted in bitmaps.
+ */
+void BetColumns::aggregateLotRange(size_t rows, uint32_t firstLotId, uint32_t lastLotId, uint32_t maxCustomer,
+                                   std::vector<LotAggregate> &perLot) const {
+    uint32_t span = lastLotId - firstLotId;
+    std::vector<LotAggregate> lots((size_t) span + 1);
+
+    forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t offset = chunk.lots[i] - firstLotId;
+            if (offset <= span) {
+                ++lots[offset].bets;
+                lots[offset].maxPrice = std::max(lots[offset].maxPrice, chunk.prices[i]);
+            }
+        }
+    });
+
+    uint64_t bets = 0;
+    for (auto i = lots.begin(); i != lots.end(); ++i)
+        bets += i->bets;
+
+    std::vector<uint64_t> pairs;
+    pairs.reserve(std::min(bets, (uint64_t) LOT_BLOCK_ROWS));
+    for (size_t begin = 0; begin < lots.size();) {
+        size_t end = begin;
+        uint64_t blockBets = 0;
+        while (end < lots.size() && (end == begin || blockBets + lots[end].bets <= LOT_BLOCK_ROWS))
+            blockBets += lots[end++].bets;
+
+        uint32_t blockFirst = firstLotId + (uint32_t) begin;
+        uint32_t blockSpan = (uint32_t) (end - 1 - begin);
+        if (blockBets > LOT_BLOCK_ROWS) {
+            lots[begin].uniqueBidders = countBidders(rows, blockFirst, blockFirst, maxCustomer);
+        } else if (blockBets) {
+            pairs.clear();
+            forEachChunk(rows, [&](const Chunk &chunk, size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    uint32_t offset = chunk.lots[i] - blockFirst;
+                    if (offset <= blockSpan)
+                        pairs.push_back((uint64_t) offset << 32 | chunk.customers[i]);
+                }
+            });
+            std::sort(pairs.begin(), pairs.end());
+
+            for (size_t i = 0; i < pairs.size(); ++i) {
+                if (i == 0 || pairs[i] != pairs[i - 1])
+                    ++lots[begin + (pairs[i] >> 32)].uniqueBidders;
+            }
+        }
+        begin = end;
+    }
+
+    for (size_t i = 0; i < lots.size(); ++i) {
+        if (lots[i].bets) {
+            lots[i].lotId = firstLotId + (uint32_t) i;
+            perLot.push_back(lots[i]);
+        }
+    }
+}
+
+
+void BetColumns::aggregateLots(std::vector<Row> &selected, std::vector<LotAggregate> &perLot) {
+    std::sort(selected.begin(), selected.end());
+
+    for (size_t i = 0; i < selected.size(); ++i) {
+        if (i == 0 || selected[i].lotId != selected[i - 1].lotId)
+            perLot.push_back(LotAggregate(selected[i].lotId));
+
+        LotAggregate &lot = perLot.back();
+        ++lot.bets;
+        lot.maxPrice = std::max(lot.maxPrice, selected[i].price);
+        if (lot.bets == 1 || selected[i].customerId != selected[i - 1].customerId)
+            ++lot.uniqueBidders;
+    }
+}
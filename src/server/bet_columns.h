@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "../protocol.h"
+#include "memory_budget.h"
+
+
+/*
+ * Every recorded bet as a row of three columns: lot id, customer id and
+ * price, in the order the bets were recorded. Columns are split into
+ * fixed-size chunks with a fixed-size directory, like LotTable, and rows
+ * are never changed, so the first size() rows are a consistent snapshot
+ * that can be scanned without a lock while the owner appends more.
+ * Only one thread may append at a time.
+ */
+class BetColumns {
+public:
+    static const uint32_t CHUNK_BITS = 16;
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 1u << 14;
+
+    BetColumns();
+
+    ~BetColumns();
+
+    BetColumns(const BetColumns &) = delete;
+
+    BetColumns &operator=(const BetColumns &) = delete;
+
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Throws std::length_error when the columns are full.
+     */
+    void append(uint32_t lotId, uint32_t customerId, uint32_t price);
+
+    /*
+     * Aggregates of the bets of lots with ids in [firstLotId, lastLotId]
+     * over the rows recorded so far. perLot, if given, gets a row for
+     * every lot with bets in id order; it takes memory and time in
+     * proportion to the width of the range, which the caller has to
+     * bound, see MAX_AGGREGATE_LOTS.
+     * The scratch memory is charged to the REQUESTS category of budget
+     * if one is given, returns false if it doesn't fit.
+     */
+    bool aggregate(uint32_t firstLotId, uint32_t lastLotId, BetAggregate &result,
+                   std::vector<LotAggregate> *perLot = nullptr, MemoryBudget *budget = nullptr) const;
+
+private:
+    struct Chunk {
+        uint32_t lots[CHUNK_SIZE];
+        uint32_t customers[CHUNK_SIZE];
+        uint32_t prices[CHUNK_SIZE];
+    };
+
+    struct Row {
+        uint32_t lotId;
+        uint32_t customerId;
+        uint32_t price;
+
+        bool operator<(const Row &other) const {
+            return lotId < other.lotId || (lotId == other.lotId && customerId < other.customerId);
+        }
+    };
+
+    std::atomic<Chunk *> chunks[MAX_CHUNKS];
+    std::atomic<size_t> count;
+
+    /*
+     * Calls scan(chunk, rows) for the chunks holding the first rows rows.
+     */
+    template<typename Scan>
+    void forEachChunk(size_t rows, Scan scan) const {
+        for (size_t i = 0; i * CHUNK_SIZE < rows; ++i) {
+            size_t n = rows - i * CHUNK_SIZE < CHUNK_SIZE ? rows - i * CHUNK_SIZE : CHUNK_SIZE;
+            scan(*chunks[i].load(std::memory_order_acquire), n);
+        }
+    }
+
+    void selectRows(size_t rows, uint32_t firstLotId, uint32_t lastLotId, std::vector<Row> &selected) const;
+
+    void percentiles(size_t rows, uint32_t firstLotId, uint32_t lastLotId, uint64_t bets,
+                     BetAggregate &result) const;
+
+    uint32_t countBidders(size_t rows, uint32_t firstLotId, uint32_t lastLotId, uint32_t maxCustomer) const;
+
+    static void aggregateSelected(std::vector<Row> &selected, BetAggregate &result);
+
+    static void aggregateLots(std::vector<Row> &selected, std::vector<LotAggregate> &perLot);
+
+    void aggregateLotRange(size_t rows, uint32_t firstLotId, uint32_t lastLotId, uint32_t maxCustomer,
+                           std::vector<LotAggregate> &perLot) const;
+};
@@ -0,0 +1,291 @@
+#include "bet_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BET_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Lot ids are compared as lot - first <= last - first,
+ * one unsigned comparison per row.
+ */
+static inline bool selected(uint32_t lot, uint32_t firstLotId, uint32_t span) {
+    return lot - firstLotId <= span;
+}
+
+
+static void scanPricesScalar(const uint32_t *lots, const uint32_t *prices, const uint32_t *customers, size_t n,
+                             uint32_t firstLotId, uint32_t span, PriceStats &stats) {
+    for (size_t i = 0; i < n; ++i) {
+        if (!selected(lots[i], firstLotId, span))
+            continue;
+        ++stats.count;
+        stats.sum += prices[i];
+        if (prices[i] < stats.minPrice)
+            stats.minPrice = prices[i];
+        if (prices[i] > stats.maxPrice)
+            stats.maxPrice = prices[i];
+        if (customers[i] > stats.maxCustomer)
+            stats.maxCustomer = customers[i];
+    }
+}
+
+
+#ifdef BET_KERNELS_X86
+
+/*
+ * Per lane: a selected row has all bits of the mask set. Counts go
+ * as the sum of masks (-1 each), sums widen to 64 bits every step,
+ * minimums see unselected rows as UINT32_MAX, maximums as 0.
+ */
+__attribute__((target("avx2")))
+static size_t scanPricesAvx2(const uint32_t *lots, const uint32_t *prices, const uint32_t *customers, size_t n,
+                             uint32_t firstLotId, uint32_t span, PriceStats &stats) {
+    const __m256i first = _mm256_set1_epi32((int) firstLotId);
+    const __m256i last = _mm256_set1_epi32((int) span);
+    const __m256i ones = _mm256_set1_epi32(-1);
+    __m256i count = _mm256_setzero_si256();
+    __m256i sumLow = _mm256_setzero_si256();
+    __m256i sumHigh = _mm256_setzero_si256();
+    __m256i minPrice = ones;
+    __m256i maxPrice = _mm256_setzero_si256();
+    __m256i maxCustomer = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i offset = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) (lots + i)), first);
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_min_epu32(offset, last), offset);
+        __m256i price = _mm256_loadu_si256((const __m256i *) (prices + i));
+        __m256i customer = _mm256_loadu_si256((const __m256i *) (customers + i));
+        __m256i selectedPrice = _mm256_and_si256(price, mask);
+
+        count = _mm256_sub_epi32(count, mask);
+        sumLow = _mm256_add_epi64(sumLow, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(selectedPrice)));
+        sumHigh = _mm256_add_epi64(sumHigh, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(selectedPrice, 1)));
+        minPrice = _mm256_min_epu32(minPrice, _mm256_or_si256(price, _mm256_xor_si256(mask, ones)));
+        maxPrice = _mm256_max_epu32(maxPrice, selectedPrice);
+        maxCustomer = _mm256_max_epu32(maxCustomer, _mm256_and_si256(customer, mask));
+    }
+
+    uint32_t counts[8], mins[8], maxs[8], customersMax[8];
+    uint64_t sums[4];
+    _mm256_storeu_si256((__m256i *) counts, count);
+    _mm256_storeu_si256((__m256i *) mins, minPrice);
+    _mm256_storeu_si256((__m256i *) maxs, maxPrice);
+    _mm256_storeu_si256((__m256i *) customersMax, maxCustomer);
+    _mm256_storeu_si256((__m256i *) sums, _mm256_add_epi64(sumLow, sumHigh));
+
+    for (int lane = 0; lane < 8; ++lane) {
+        stats.count += counts[lane];
+        if (mins[lane] < stats.minPrice)
+            stats.minPrice = mins[lane];
+        if (maxs[lane] > stats.maxPrice)
+            stats.maxPrice = maxs[lane];
+        if (customersMax[lane] > stats.maxCustomer)
+            stats.maxCustomer = customersMax[lane];
+    }
+    for (int lane = 0; lane < 4; ++lane)
+        stats.sum += sums[lane];
+
+    return i;
+}
+
+
+__attribute__((target("sse4.1")))
+static size_t scanPricesSse41(const uint32_t *lots, const uint32_t *prices, const uint32_t *customers, size_t n,
+                              uint32_t firstLotId, uint32_t span, PriceStats &stats) {
+    const __m128i first = _mm_set1_epi32((int) firstLotId);
+    const __m128i last = _mm_set1_epi32((int) span);
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i count = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+    __m128i minPrice = ones;
+    __m128i maxPrice = _mm_setzero_si128();
+    __m128i maxCustomer = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i offset = _mm_sub_epi32(_mm_loadu_si128((const __m128i *) (lots + i)), first);
+        __m128i mask = _mm_cmpeq_epi32(_mm_min_epu32(offset, last), offset);
+        __m128i price = _mm_loadu_si128((const __m128i *) (prices + i));
+        __m128i customer = _mm_loadu_si128((const __m128i *) (customers + i));
+        __m128i selectedPrice = _mm_and_si128(price, mask);
+
+        count = _mm_sub_epi32(count, mask);
+        sum = _mm_add_epi64(sum, _mm_cvtepu32_epi64(selectedPrice));
+        sum = _mm_add_epi64(sum, _mm_cvtepu32_epi64(_mm_srli_si128(selectedPrice, 8)));
+        minPrice = _mm_min_epu32(minPrice, _mm_or_si128(price, _mm_xor_si128(mask, ones)));
+        maxPrice = _mm_max_epu32(maxPrice, selectedPrice);
+        maxCustomer = _mm_max_epu32(maxCustomer, _mm_and_si128(customer, mask));
+    }
+
+    uint32_t counts[4], mins[4], maxs[4], customersMax[4];
+    uint64_t sums[2];
+    _mm_storeu_si128((__m128i *) counts, count);
+    _mm_storeu_si128((__m128i *) mins, minPrice);
+    _mm_storeu_si128((__m128i *) maxs, maxPrice);
+    _mm_storeu_si128((__m128i *) customersMax, maxCustomer);
+    _mm_storeu_si128((__m128i *) sums, sum);
+
+    for (int lane = 0; lane < 4; ++lane) {
+        stats.count += counts[lane];
+        if (mins[lane] < stats.minPrice)
+            stats.minPrice = mins[lane];
+        if (maxs[lane] > stats.maxPrice)
+            stats.maxPrice = maxs[lane];
+        if (customersMax[lane] > stats.maxCustomer)
+            stats.maxCustomer = customersMax[lane];
+    }
+    stats.sum += sums[0] + sums[1];
+
+    return i;
+}
+
+
+/*
+ * Masks of the selected rows of 8 lots, bit i for row i.
+ */
+__attribute__((target("avx2")))
+static inline unsigned selectAvx2(const uint32_t *lots, __m256i first, __m256i last) {
+    __m256i offset = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) lots), first);
+    __m256i mask = _mm256_cmpeq_epi32(_mm256_min_epu32(offset, last), offset);
+    return (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+}
+
+
+__attribute__((target("avx2")))
+static size_t histogramHighAvx2(const uint32_t *lots, const uint32_t *prices, size_t n,
+                                uint32_t firstLotId, uint32_t span, uint64_t *buckets) {
+    const __m256i first = _mm256_set1_epi32((int) firstLotId);
+    const __m256i last = _mm256_set1_epi32((int) span);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (unsigned mask = selectAvx2(lots + i, first, last); mask; mask &= mask - 1)
+            ++buckets[prices[i + __builtin_ctz(mask)] >> 16];
+    }
+    return i;
+}
+
+
+__attribute__((target("avx2")))
+static size_t histogramLowAvx2(const uint32_t *lots, const uint32_t *prices, size_t n,
+                               uint32_t firstLotId, uint32_t span, uint32_t high, uint64_t *buckets) {
+    const __m256i first = _mm256_set1_epi32((int) firstLotId);
+    const __m256i last = _mm256_set1_epi32((int) span);
+    const __m256i highs = _mm256_set1_epi32((int) high);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i price = _mm256_loadu_si256((const __m256i *) (prices + i));
+        __m256i sameHigh = _mm256_cmpeq_epi32(_mm256_srli_epi32(price, 16), highs);
+        unsigned mask = selectAvx2(lots + i, first, last)
+                        & (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(sameHigh));
+        for (; mask; mask &= mask - 1)
+            ++buckets[prices[i + __builtin_ctz(mask)] & 0xffff];
+    }
+    return i;
+}
+
+
+__attribute__((target("avx2")))
+static size_t markCustomersAvx2(const uint32_t *lots, const uint32_t *customers, size_t n,
+                                uint32_t firstLotId, uint32_t span, uint32_t firstCustomer, uint32_t bits,
+                                uint64_t *bitmap) {
+    const __m256i first = _mm256_set1_epi32((int) firstLotId);
+    const __m256i last = _mm256_set1_epi32((int) span);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (unsigned mask = selectAvx2(lots + i, first, last); mask; mask &= mask - 1) {
+            uint32_t customer = customers[i + __builtin_ctz(mask)] - firstCustomer;
+            if (customer < bits)
+                bitmap[customer >> 6] |= (uint64_t) 1 << (customer & 63);
+        }
+    }
+    return i;
+}
+
+
+static bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+
+static bool hasSse41() {
+    static const bool supported = __builtin_cpu_supports("sse4.1");
+    return supported;
+}
+
+#endif
+
+
+void scanPrices(const uint32_t *lots, const uint32_t *prices, const uint32_t *customers, size_t n,
+                uint32_t firstLotId, uint32_t lastLotId, PriceStats &stats) {
+    uint32_t span = lastLotId - firstLotId;
+    size_t done = 0;
+
+#ifdef BET_KERNELS_X86
+    if (hasAvx2())
+        done = scanPricesAvx2(lots, prices, customers, n, firstLotId, span, stats);
+    else if (hasSse41())
+        done = scanPricesSse41(lots, prices, customers, n, firstLotId, span, stats);
+#endif
+
+    scanPricesScalar(lots + done, prices + done, customers + done, n - done, firstLotId, span, stats);
+}
+
+
+void histogramHigh(const uint32_t *lots, const uint32_t *prices, size_t n,
+                   uint32_t firstLotId, uint32_t lastLotId, uint64_t *buckets) {
+    uint32_t span = lastLotId - firstLotId;
+    size_t i = 0;
+
+#ifdef BET_KERNELS_X86
+    if (hasAvx2())
+        i = histogramHighAvx2(lots, prices, n, firstLotId, span, buckets);
+#endif
+
+    for (; i < n; ++i) {
+        if (selected(lots[i], firstLotId, span))
+            ++buckets[prices[i] >> 16];
+    }
+}
+
+
+void histogramLow(const uint32_t *lots, const uint32_t *prices, size_t n,
+                  uint32_t firstLotId, uint32_t lastLotId, uint32_t high, uint64_t *buckets) {
+    uint32_t span = lastLotId - firstLotId;
+    size_t i = 0;
+
+#ifdef BET_KERNELS_X86
+    if (hasAvx2())
+        i = histogramLowAvx2(lots, prices, n, firstLotId, span, high, buckets);
+#endif
+
+    for (; i < n; ++i) {
+        if (selected(lots[i], firstLotId, span) && prices[i] >> 16 == high)
+            ++buckets[prices[i] & 0xffff];
+    }
+}
+
+
+void markCustomers(const uint32_t *lots, const uint32_t *customers, size_t n,
+                   uint32_t firstLotId, uint32_t lastLotId, uint32_t firstCustomer, uint32_t bits,
+                   uint64_t *bitmap) {
+    uint32_t span = lastLotId - firstLotId;
+    size_t i = 0;
+
+#ifdef BET_KERNELS_X86
+    if (hasAvx2())
+        i = markCustomersAvx2(lots, customers, n, firstLotId, span, firstCustomer, bits, bitmap);
+#endif
+
+    for (; i < n; ++i) {
+        uint32_t customer = customers[i] - firstCustomer;
+        if (selected(lots[i], firstLotId, span) && customer < bits)
+            bitmap[customer >> 6] |= (uint64_t) 1 << (customer & 63);
+    }
+}
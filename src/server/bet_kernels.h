@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Scans over columns of bets: rows i with lots[i] in [firstLotId, lastLotId]
+ * are selected. Every scan adds to what it's given, so a column can be
+ * scanned chunk by chunk. AVX2 or SSE4.1 code is chosen at run time
+ * by what the CPU supports, other CPUs run the scalar code.
+ */
+struct PriceStats {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint32_t minPrice = UINT32_MAX;
+    uint32_t maxPrice = 0;
+    uint32_t maxCustomer = 0;
+};
+
+
+void scanPrices(const uint32_t *lots, const uint32_t *prices, const uint32_t *customers, size_t n,
+                uint32_t firstLotId, uint32_t lastLotId, PriceStats &stats);
+
+/*
+ * Counts selected prices by their high 16 bits into 65536 buckets.
+ */
+void histogramHigh(const uint32_t *lots, const uint32_t *prices, size_t n,
+                   uint32_t firstLotId, uint32_t lastLotId, uint64_t *buckets);
+
+/*
+ * Counts selected prices whose high 16 bits are high by their low 16 bits.
+ */
+void histogramLow(const uint32_t *lots, const uint32_t *prices, size_t n,
+                  uint32_t firstLotId, uint32_t lastLotId, uint32_t high, uint64_t *buckets);
+
+/*
+ * Sets bits customer - firstCustomer of the customers of selected rows
+ * which are in [firstCustomer, firstCustomer + bits).
+ */
+void markCustomers(const uint32_t *lots, const uint32_t *customers, size_t n,
+                   uint32_t firstLotId, uint32_t lastLotId, uint32_t firstCustomer, uint32_t bits,
+                   uint64_t *bitmap);
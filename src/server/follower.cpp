@@ -0,0 +1,106 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include "follower.h"
+#include "trade_server.h"
+
+
+Follower::Follower(DataStorage *dataStorage, const char *primaryAddr, tcp_port primaryPort, unsigned maxStalenessMs)
+        : dataStorage(dataStorage), primaryAddr(primaryAddr), primaryPort(primaryPort),
+          maxStalenessMs(maxStalenessMs), stopped(false), lastContactMs(INT64_MIN / 2) {
+    thread = std::thread(runWrapper, this);
+}
+
+
+int64_t Follower::nowMs() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+
+bool Follower::isFresh() {
+    return nowMs() - lastContactMs.load(std::memory_order_relaxed) <= maxStalenessMs;
+}
+
+
+void Follower::follow() {
+    Packet packet;
+
+    primary->connect();
+    packet.readFromStreamSocket(primary);
+    if (packet.getBody()->getType() != Body::BodyType::AUTH_RESP)
+        throw std::runtime_error("primary refused the connection");
+
+    Packet::constructFeaturesRequest(FEATURE_COMPRESSION).writeToStreamSocket(primary);
+    packet.readFromStreamSocket(primary);
+
+    /*
+     * свой журнал фолловер ведёт так же, как основной сервер,
+     * его длина и есть число уже применённых изменений
+     */
+    uint64_t applied = dataStorage->getReplicationLog()->size();
+    Packet::constructReplicateRequest(applied).writeToStreamSocket(primary);
+    std::cerr << "following the primary from mutation " << applied << '\n';
+
+    while (!stopped) {
+        packet.readFromStreamSocket(primary);
+        if (packet.getBody()->getType() == Body::BodyType::REJECTED)
+            throw std::runtime_error(((Rejected *) packet.getBody())->getReasonText());
+        if (packet.getBody()->getType() != Body::BodyType::REPLICATION_BATCH)
+            throw std::runtime_error("unexpected message from the primary");
+
+        ReplicationBatch *batch = (ReplicationBatch *) packet.getBody();
+        if (batch->getFirst() != applied)
+            throw std::runtime_error("replication stream has a gap");
+
+        dataStorage->replicate(batch->getMutations());
+        applied += batch->getMutations().size();
+        lastContactMs.store(nowMs(), std::memory_order_relaxed);
+    }
+}
+
+
+void Follower::run() {
+    while (!stopped) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            primary = new tcp_client_socket(primaryAddr, primaryPort);
+        }
+
+        try {
+            follow();
+        } catch (std::exception &e) {
+            /*
+             * основной сервер недоступен или поток оборвался,
+             * переподключаемся и продолжаем с того же места
+             */
+            std::cerr << "replication: " << e.what() << '\n';
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        delete primary;
+        primary = nullptr;
+        if (!stopped)
+            stopping.wait_for(lock, std::chrono::seconds(1));
+    }
+}
+
+
+void Follower::stop() {
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopped = true;
+        if (primary)
+            primary->shutdown();
+        stopping.notify_one();
+    }
+    thread.join();
+}
+
+
+Follower::~Follower() {
+    stop();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "../tcp_socket.h"
+
+class DataStorage;
+
+#define REPLICATION_HEARTBEAT_MS 100
+#define REPLICATION_BATCH_LIMIT 1024
+#define DEFAULT_MAX_STALENESS_MS 1000
+
+
+/*
+ * Keeps a DataStorage a read-only copy of a primary server's one:
+ * streams the primary's replication log from the position already
+ * applied and replays it, reconnecting when the stream breaks.
+ * The primary sends a heartbeat every REPLICATION_HEARTBEAT_MS,
+ * so the copy is fresh while the last batch or heartbeat
+ * is not older than maxStalenessMs.
+ */
+class Follower {
+    DataStorage *dataStorage;
+    const char *primaryAddr;
+    tcp_port primaryPort;
+    unsigned maxStalenessMs;
+    std::thread thread;
+    std::atomic<bool> stopped;
+    std::atomic<int64_t> lastContactMs;
+    std::mutex mtx;
+    std::condition_variable stopping;
+    tcp_client_socket *primary = nullptr;
+
+    static int64_t nowMs();
+
+    void follow();
+
+    void run();
+
+    static void runWrapper(Follower *self) {
+        self->run();
+    }
+
+public:
+    Follower(DataStorage *dataStorage, const char *primaryAddr, tcp_port primaryPort,
+             unsigned maxStalenessMs = DEFAULT_MAX_STALENESS_MS);
+
+    Follower(const Follower &) = delete;
+
+    Follower &operator=(const Follower &) = delete;
+
+    bool isFresh();
+
+    void stop();
+
+    ~Follower();
+};
@@ -0,0 +1,114 @@
+#include "lock_profiler.h"
+
+
+static int bucketOf(uint64_t ns) {
+    int bucket = 0;
+    while (ns && bucket < LockSite::BUCKETS - 1) {
+        ns >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+
+static void updateMax(std::atomic<uint64_t> &max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (current < value && !max.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+
+static void reportHistogram(std::ostream &out, const char *title, const std::atomic<uint64_t> *histogram) {
+    out << "    " << title << ":";
+    for (int i = 0; i < LockSite::BUCKETS; ++i) {
+        uint64_t count = histogram[i].load(std::memory_order_relaxed);
+        if (count)
+            out << " <" << (i ? (1ULL << i) : 1) << "ns:" << count;
+    }
+    out << '\n';
+}
+
+
+/*
+ * LockSite implementation
+ */
+
+LockSite::LockSite(const char *name) : name(name) {
+    reset();
+    LockProfiler::instance().registerSite(this);
+}
+
+
+void LockSite::record(uint64_t waitNs, uint64_t holdNs) {
+    acquisitions.fetch_add(1, std::memory_order_relaxed);
+    totalWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+    totalHoldNs.fetch_add(holdNs, std::memory_order_relaxed);
+    updateMax(maxWaitNs, waitNs);
+    updateMax(maxHoldNs, holdNs);
+    waitHistogram[bucketOf(waitNs)].fetch_add(1, std::memory_order_relaxed);
+    holdHistogram[bucketOf(holdNs)].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void LockSite::report(std::ostream &out) const {
+    uint64_t count = acquisitions.load(std::memory_order_relaxed);
+
+    out << name << ": acquisitions " << count;
+    if (!count) {
+        out << '\n';
+        return;
+    }
+
+    out << ", wait avg " << totalWaitNs.load(std::memory_order_relaxed) / count << "ns"
+        << " max " << maxWaitNs.load(std::memory_order_relaxed) << "ns"
+        << ", hold avg " << totalHoldNs.load(std::memory_order_relaxed) / count << "ns"
+        << " max " << maxHoldNs.load(std::memory_order_relaxed) << "ns"
+        << ", total hold " << totalHoldNs.load(std::memory_order_relaxed) / 1000 << "us\n";
+    reportHistogram(out, "wait", waitHistogram);
+    reportHistogram(out, "hold", holdHistogram);
+}
+
+
+void LockSite::reset() {
+    acquisitions = 0;
+    totalWaitNs = 0;
+    totalHoldNs = 0;
+    maxWaitNs = 0;
+    maxHoldNs = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        waitHistogram[i] = 0;
+        holdHistogram[i] = 0;
+    }
+}
+
+
+/*
+ * LockProfiler implementation
+ */
+
+LockProfiler &LockProfiler::instance() {
+    static LockProfiler profiler;
+    return profiler;
+}
+
+
+void LockProfiler::registerSite(LockSite *site) {
+    std::unique_lock<std::mutex> lock(mtx);
+    sites.push_back(site);
+}
+
+
+void LockProfiler::report(std::ostream &out) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    out << "lock profile:\n";
+    for (auto i = sites.begin(); i != sites.end(); ++i)
+        (*i)->report(out);
+}
+
+
+void LockProfiler::reset() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    for (auto i = sites.begin(); i != sites.end(); ++i)
+        (*i)->reset();
+}
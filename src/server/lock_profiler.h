@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <stdint.h>
+#include "priority_mutex.h"
+
+
+/*
+ * Contention statistics of one call site of a ProfiledMutex.
+ * Histograms are log2-bucketed by nanoseconds:
+ * bucket i holds samples in [2^(i-1), 2^i) ns, bucket 0 holds zeros.
+ * All counters are updated with relaxed atomics, so a report taken
+ * under load is approximate but never blocks the profiled code.
+ */
+class LockSite {
+public:
+    static const int BUCKETS = 40;
+
+    explicit LockSite(const char *name);
+
+    const char *getName() const {
+        return name;
+    }
+
+    void record(uint64_t waitNs, uint64_t holdNs);
+
+    void report(std::ostream &out) const;
+
+    void reset();
+
+private:
+    const char *name;
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> totalWaitNs;
+    std::atomic<uint64_t> totalHoldNs;
+    std::atomic<uint64_t> maxWaitNs;
+    std::atomic<uint64_t> maxHoldNs;
+    std::atomic<uint64_t> waitHistogram[BUCKETS];
+    std::atomic<uint64_t> holdHistogram[BUCKETS];
+};
+
+
+/*
+ * Global registry of all lock sites, sites register themselves on construction.
+ */
+class LockProfiler {
+    std::mutex mtx;
+    std::vector<LockSite *> sites;
+
+public:
+    static LockProfiler &instance();
+
+    void registerSite(LockSite *site);
+
+    void report(std::ostream &out);
+
+    void reset();
+};
+
+
+/*
+ * PriorityMutex taken only through ProfiledLock with a static LockSite
+ * naming the operation, which records how long the callers wait for it
+ * and hold it:
+ *
+ *     static LockSite site("makeBet");
+ *     ProfiledLock lock(mtx, site);
+ */
+class ProfiledMutex {
+    PriorityMutex mtx;
+
+    friend class ProfiledLock;
+
+    void lock(PriorityMutex::Priority priority = PriorityMutex::URGENT) {
+        mtx.lock(priority);
+    }
+
+    void unlock() {
+        mtx.unlock();
+    }
+
+    bool try_lock() {
+        return mtx.try_lock();
+    }
+
+public:
+    void setUrgentPerBulk(unsigned urgentPerBulk) {
+        mtx.setUrgentPerBulk(urgentPerBulk);
+    }
+};
+
+
+class ProfiledLock {
+    typedef std::chrono::steady_clock clock;
+
+    ProfiledMutex &mtx;
+    LockSite &site;
+    clock::time_point requested;
+    clock::time_point acquired;
+
+public:
+    ProfiledLock(ProfiledMutex &mtx, LockSite &site, PriorityMutex::Priority priority = PriorityMutex::URGENT)
+            : mtx(mtx), site(site) {
+        requested = clock::now();
+        mtx.lock(priority);
+        acquired = clock::now();
+    }
+
+    ~ProfiledLock() {
+        clock::time_point released = clock::now();
+        mtx.unlock();
+        site.record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(acquired - requested).count(),
+                    (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(released - acquired).count());
+    }
+
+    ProfiledLock(const ProfiledLock &) = delete;
+
+    ProfiledLock &operator=(const ProfiledLock &) = delete;
+};
@@ -0,0 +1,39 @@
+#include <stdexcept>
+#include "lot_table.h"
+
+
+LotTable::LotTable(uint32_t shard, uint32_t shards) : shard(shard), shards(shards), count(0) {
+    for (uint32_t i = 0; i < MAX_CHUNKS; ++i)
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+
+LotTable::~LotTable() {
+    for (uint32_t i = 0; i < MAX_CHUNKS; ++i)
+        delete[] chunks[i].load(std::memory_order_relaxed);
+}
+
+
+uint32_t LotTable::append(const LotFullInfo &lot) {
+    uint32_t slot = count.load(std::memory_order_relaxed);
+    uint32_t chunk = slot >> CHUNK_BITS;
+
+    if (chunk >= MAX_CHUNKS || (uint64_t) slot * shards + shard + 1 > UINT32_MAX)
+        throw std::length_error("lot table is full");
+
+    if (!chunks[chunk].load(std::memory_order_relaxed))
+        chunks[chunk].store(new Slot[CHUNK_SIZE], std::memory_order_release);
+
+    Slot &stored = chunks[chunk].load(std::memory_order_relaxed)[slot & (CHUNK_SIZE - 1)];
+    stored.lot = lot;
+    stored.lot.lotId = idAt(slot);
+    stored.bestBet.store(BestBet::pack(lot.getBestPrice(), 0) | (lot.opened ? 0 : (uint64_t) BestBet::CLOSED),
+                         std::memory_order_relaxed);
+    stored.version.store(1, std::memory_order_relaxed);
+
+    /*
+     * лот становится виден в find только после того, как полностью записан
+     */
+    count.store(slot + 1, std::memory_order_release);
+    return idAt(slot);
+}
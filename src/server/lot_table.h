@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include "../protocol.h"
+#include "timer_wheel.h"
+
+
+/*
+ * Best bet of a lot packed in one word, so it can be raised by CAS:
+ * the price in the high half, the closed flag and the bidder in the low half.
+ */
+struct BestBet {
+    static const uint64_t CLOSED = 1u << 31;
+
+    static uint64_t pack(uint32_t price, uint32_t bidder) {
+        return ((uint64_t) price << 32) | (bidder & (CLOSED - 1));
+    }
+
+    static uint32_t getPrice(uint64_t word) {
+        return (uint32_t) (word >> 32);
+    }
+
+    static uint32_t getBidder(uint64_t word) {
+        return (uint32_t) (word & (CLOSED - 1));
+    }
+
+    static bool isClosed(uint64_t word) {
+        return (word & CLOSED) != 0;
+    }
+};
+
+
+/*
+ * Deadline of a timed lot, extension is in the owner's timer ticks.
+ */
+struct LotDeadline {
+    TimerWheel::Timer timer;
+    uint64_t extension = 0;
+};
+
+
+/*
+ * Lots indexed directly by id: a table is shard number shard of shards,
+ * the lot in slot n has id n * shards + shard + 1, so an id tells both
+ * the shard owning the lot and its slot. Slots make a chain
+ * of fixed-size chunks. Chunks are never
+ * moved or freed before the table, so references to lots stay valid,
+ * and the chunk directory has a fixed size, so find may run concurrently
+ * with append without a lock. Fields of a lot are still protected
+ * by the owner's lock. Unknown ids are never inserted.
+ */
+class LotTable {
+public:
+    static const uint32_t CHUNK_BITS = 12;
+    static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+    static const uint32_t MAX_CHUNKS = 1u << 14;
+
+    LotTable(uint32_t shard = 0, uint32_t shards = 1);
+
+    ~LotTable();
+
+    LotTable(const LotTable &) = delete;
+
+    LotTable &operator=(const LotTable &) = delete;
+
+    uint32_t getShard() const {
+        return shard;
+    }
+
+    uint32_t getShards() const {
+        return shards;
+    }
+
+    /*
+     * Number of lots, the ids in use are idAt(0)..idAt(size() - 1).
+     */
+    uint32_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    uint32_t idAt(uint32_t slot) const {
+        return slot * shards + shard + 1;
+    }
+
+    /*
+     * Returns nullptr for an unknown id or an id of another shard.
+     */
+    LotFullInfo *find(uint32_t lotId) {
+        if (lotId == 0 || (lotId - 1) % shards != shard || (lotId - 1) / shards >= size())
+            return nullptr;
+        return &get(lotId);
+    }
+
+    /*
+     * The id must be one of the table's ids.
+     */
+    LotFullInfo &get(uint32_t lotId) {
+        return getSlot(lotId).lot;
+    }
+
+    /*
+     * Best bet word of a lot, see BestBet. It may be used without the lock.
+     * The id must be one of the table's ids.
+     */
+    std::atomic<uint64_t> &getBestBet(uint32_t lotId) {
+        return getSlot(lotId).bestBet;
+    }
+
+    /*
+     * Bumped by the owner on every change of the lot,
+     * it may be read without the lock.
+     * The id must be one of the table's ids.
+     */
+    std::atomic<uint32_t> &getVersion(uint32_t lotId) {
+        return getSlot(lotId).version;
+    }
+
+    /*
+     * The id must be one of the table's ids.
+     */
+    LotDeadline &getDeadline(uint32_t lotId) {
+        return getSlot(lotId).deadline;
+    }
+
+    /*
+     * Adds a lot with id idAt(size()), its lotId is set by the table.
+     * Only one thread may append at a time.
+     * Throws std::length_error when the table is full.
+     */
+    uint32_t append(const LotFullInfo &lot);
+
+private:
+    struct Slot {
+        LotFullInfo lot;
+        std::atomic<uint64_t> bestBet;
+        std::atomic<uint32_t> version;
+        LotDeadline deadline;
+    };
+
+    uint32_t shard;
+    uint32_t shards;
+    std::atomic<Slot *> chunks[MAX_CHUNKS];
+    std::atomic<uint32_t> count;
+
+    Slot &getSlot(uint32_t lotId) {
+        uint32_t slot = (lotId - 1) / shards;
+        return chunks[slot >> CHUNK_BITS].load(std::memory_order_acquire)[slot & (CHUNK_SIZE - 1)];
+    }
+};
@@ -0,0 +1,65 @@
+#include "memory_budget.h"
+
+
+const char *MemoryLimits::getName(Category category) {
+    switch (category) {
+        case CONNECTIONS:
+            return "connections";
+        case REQUESTS:
+            return "requests";
+        case STORAGE:
+            return "storage";
+        default:
+            return "unknown";
+    }
+}
+
+
+MemoryBudget::MemoryBudget(const MemoryLimits &limits) : limits(limits), total(0) {
+    for (int i = 0; i < MemoryLimits::CATEGORIES; ++i) {
+        used[i] = 0;
+        refused[i] = 0;
+    }
+}
+
+
+bool MemoryBudget::hasRoom(Category category, size_t bytes) {
+    size_t categoryLimit = limits.perCategory[category];
+    if ((categoryLimit && getUsed(category) + bytes > categoryLimit)
+        || (limits.total && getTotal() + bytes > limits.total)) {
+        refused[category].fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+
+bool MemoryBudget::tryCharge(Category category, size_t bytes) {
+    if (!hasRoom(category, bytes))
+        return false;
+    charge(category, bytes);
+    return true;
+}
+
+
+void MemoryBudget::charge(Category category, size_t bytes) {
+    used[category].fetch_add(bytes, std::memory_order_relaxed);
+    total.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+
+void MemoryBudget::release(Category category, size_t bytes) {
+    used[category].fetch_sub(bytes, std::memory_order_relaxed);
+    total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+
+void MemoryBudget::report(std::ostream &out) {
+    out << "memory used, bytes (limit, refusals):\n";
+    for (int i = 0; i < MemoryLimits::CATEGORIES; ++i) {
+        Category category = (Category) i;
+        out << MemoryLimits::getName(category) << ": " << getUsed(category)
+            << " (" << limits.perCategory[i] << ", " << refused[i].load(std::memory_order_relaxed) << ")\n";
+    }
+    out << "total: " << getTotal() << " (" << limits.total << ")\n";
+}
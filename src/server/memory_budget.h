@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <stddef.h>
+#include <stdint.h>
+#include "../stream_socket.h"
+
+
+/*
+ * Limits in bytes of every category and of all of them together,
+ * 0 means no limit.
+ */
+struct MemoryLimits {
+    enum Category {
+        CONNECTIONS,
+        REQUESTS,
+        STORAGE,
+        CATEGORIES
+    };
+
+    size_t perCategory[CATEGORIES] = {};
+    size_t total = 0;
+
+    static const char *getName(Category category);
+};
+
+
+/*
+ * Accounting of the memory the server holds on behalf of clients:
+ * sessions with their outbound queues, requests being served, and the
+ * storage with its indexes and replication log. The numbers are
+ * estimates charged by the code allocating the memory, kept in relaxed
+ * atomics, so the checks are cheap and may overshoot a limit by the
+ * charges racing with them.
+ *
+ * Growth that can be refused is charged through tryCharge, growth that
+ * can't (a response being queued, a replicated change) through charge,
+ * and is then stopped by refusing the next request.
+ */
+class MemoryBudget {
+    MemoryLimits limits;
+    std::atomic<size_t> used[MemoryLimits::CATEGORIES];
+    std::atomic<size_t> total;
+    std::atomic<uint64_t> refused[MemoryLimits::CATEGORIES];
+
+public:
+    typedef MemoryLimits::Category Category;
+
+    explicit MemoryBudget(const MemoryLimits &limits = MemoryLimits());
+
+    MemoryBudget(const MemoryBudget &) = delete;
+
+    MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+    /*
+     * True if bytes more fit both the category and the total limit,
+     * a refusal is counted.
+     */
+    bool hasRoom(Category category, size_t bytes = 0);
+
+    bool tryCharge(Category category, size_t bytes);
+
+    void charge(Category category, size_t bytes);
+
+    void release(Category category, size_t bytes);
+
+    size_t getUsed(Category category) {
+        return used[category].load(std::memory_order_relaxed);
+    }
+
+    size_t getTotal() {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    void report(std::ostream &out);
+
+    /*
+     * Charge released when it goes out of scope, budget may be null.
+     */
+    class Charge {
+        MemoryBudget *budget;
+        Category category;
+        size_t bytes;
+
+    public:
+        Charge(MemoryBudget *budget, Category category, size_t bytes)
+                : budget(budget), category(category), bytes(bytes) {}
+
+        Charge(const Charge &) = delete;
+
+        Charge &operator=(const Charge &) = delete;
+
+        ~Charge() {
+            if (budget)
+                budget->release(category, bytes);
+        }
+    };
+};
+
+
+/*
+ * Charges the data sockets buffer for their peers to CONNECTIONS.
+ */
+class SocketBufferAccounting : public buffer_accounting {
+    MemoryBudget *budget;
+
+public:
+    explicit SocketBufferAccounting(MemoryBudget *budget) : budget(budget) {}
+
+    void charge(size_t bytes) override {
+        budget->charge(MemoryLimits::CONNECTIONS, bytes);
+    }
+
+    void release(size_t bytes) override {
+        budget->release(MemoryLimits::CONNECTIONS, bytes);
+    }
+};
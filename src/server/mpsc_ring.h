@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Bounded lock-free queue for many producers and one consumer
+ * with preallocated slots (D. Vyukov's sequence-numbered ring).
+ * Every slot has a sequence number telling whose turn it is:
+ * pos for a producer at position pos, pos + 1 for the consumer,
+ * so producers only race on a CAS of the tail.
+ * Capacity must be a power of two.
+ */
+template<typename T>
+class MpscRing {
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    /*
+     * Producers and the consumer touch their ends on different cache lines.
+     */
+    char tailPadding[64];
+    std::atomic<size_t> tail;
+    char headPadding[64];
+    size_t head = 0;
+
+public:
+    explicit MpscRing(size_t capacity) : slots(capacity), mask(capacity - 1), tail(0) {
+        if (capacity == 0 || (capacity & (capacity - 1)))
+            throw std::invalid_argument("ring capacity must be a power of two");
+        for (size_t i = 0; i < capacity; ++i)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /*
+     * Moves value into the ring, yields while the ring is full.
+     */
+    void push(T &value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot *slot;
+
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                std::this_thread::yield();
+                pos = tail.load(std::memory_order_relaxed);
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = std::move(value);
+        slot->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    /*
+     * Consumer only. Returns false if the ring is empty.
+     */
+    bool pop(T &value) {
+        Slot *slot = &slots[head & mask];
+        if (slot->seq.load(std::memory_order_acquire) != head + 1)
+            return false;
+
+        value = std::move(slot->value);
+        slot->seq.store(head + mask + 1, std::memory_order_release);
+        ++head;
+        return true;
+    }
+
+    /*
+     * Consumer only.
+     */
+    bool empty() const {
+        return slots[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+    }
+};
@@ -0,0 +1,164 @@
+#include <stdexcept>
+#include "order_engine.h"
+#include "trade_server.h"
+
+
+static LockSite engineBatchSite("engineBatch");
+
+
+OrderEngine::OrderEngine(DataStorage *dataStorage, size_t capacity)
+        : dataStorage(dataStorage), commands(capacity), stopped(false), sleeping(false) {
+    thread = std::thread(runWrapper, this);
+}
+
+
+uint32_t OrderEngine::submit(Command &command) {
+    static thread_local Completion completion;
+    command.completion = &completion;
+
+    commands.push(command);
+
+    /*
+     * пара к барьеру в run: либо движок увидит команду,
+     * либо мы увидим, что он заснул, и разбудим его
+     */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(sleepMtx);
+        wakeUp.notify_one();
+    }
+
+    std::unique_lock<std::mutex> lock(completion.mtx);
+    completion.cv.wait(lock, [] { return completion.done; });
+    completion.done = false;
+
+    if (!completion.error.empty()) {
+        std::string error;
+        error.swap(completion.error);
+        throw std::runtime_error(error);
+    }
+    return completion.result;
+}
+
+
+uint32_t OrderEngine::addNewLot(uint32_t startPrice, uint32_t ownerId, std::string description, uint32_t duration,
+                                uint32_t extension) {
+    Command command;
+    command.type = Command::ADD_NEW_LOT;
+    command.uid = ownerId;
+    command.startPrice = startPrice;
+    command.duration = duration;
+    command.extension = extension;
+    command.description.swap(description);
+    return submit(command);
+}
+
+
+bool OrderEngine::makeBet(uint32_t uid, const Bet &bet) {
+    Command command;
+    command.type = Command::MAKE_BET;
+    command.uid = uid;
+    command.bet = bet;
+    return submit(command) != 0;
+}
+
+
+bool OrderEngine::closeLot(uint32_t uid, uint32_t lotId) {
+    Command command;
+    command.type = Command::CLOSE_LOT;
+    command.uid = uid;
+    command.lotId = lotId;
+    return submit(command) != 0;
+}
+
+
+uint32_t OrderEngine::closeExpiredLots() {
+    Command command;
+    command.type = Command::CLOSE_EXPIRED_LOTS;
+    return submit(command);
+}
+
+
+void OrderEngine::apply(Command &command) {
+    Completion *completion = command.completion;
+
+    try {
+        switch (command.type) {
+            case Command::ADD_NEW_LOT:
+                completion->result = dataStorage->applyAddNewLot(command.startPrice, command.uid,
+                                                                 command.description, command.duration,
+                                                                 command.extension);
+                break;
+            case Command::MAKE_BET:
+                completion->result = dataStorage->applyMakeBet(command.uid, command.bet);
+                break;
+            case Command::CLOSE_LOT:
+                completion->result = dataStorage->applyCloseLot(command.uid, command.lotId);
+                break;
+            case Command::CLOSE_EXPIRED_LOTS:
+                completion->result = dataStorage->applyCloseExpiredLots();
+                break;
+        }
+    } catch (std::exception &e) {
+        completion->error = e.what();
+    }
+}
+
+
+void OrderEngine::run() {
+    std::vector<Completion *> completed;
+    completed.reserve(BATCH_SIZE);
+    Command command;
+
+    while (true) {
+        if (commands.empty()) {
+            if (stopped.load(std::memory_order_acquire))
+                break;
+
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (commands.empty() && !stopped.load(std::memory_order_acquire))
+                wakeUp.wait(lock);
+            sleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        {
+            ProfiledLock lock(dataStorage->mtx, engineBatchSite);
+            while (completed.size() < BATCH_SIZE && commands.pop(command)) {
+                apply(command);
+                completed.push_back(command.completion);
+            }
+        }
+
+        /*
+         * ответы отдаём уже после снятия блокировки хранилища,
+         * чтобы проснувшиеся сессии не упирались в неё
+         */
+        for (auto i = completed.begin(); i != completed.end(); ++i) {
+            std::lock_guard<std::mutex> lock((*i)->mtx);
+            (*i)->done = true;
+            (*i)->cv.notify_one();
+        }
+        completed.clear();
+    }
+}
+
+
+void OrderEngine::stop() {
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMtx);
+        stopped.store(true, std::memory_order_release);
+        wakeUp.notify_one();
+    }
+    thread.join();
+}
+
+
+OrderEngine::~OrderEngine() {
+    stop();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../protocol.h"
+#include "mpsc_ring.h"
+
+class DataStorage;
+
+
+/*
+ * Single writer of a DataStorage: one thread applies every new lot,
+ * bet and close in the order they entered the command ring.
+ * Submitting threads wait for the result on their own completion,
+ * a session is served by one worker at a time, so it's per session.
+ * Commands are applied in batches under one storage lock,
+ * reads keep taking the lock as bulk and contend only with the engine.
+ */
+class OrderEngine {
+public:
+    static const size_t DEFAULT_CAPACITY = 4096;
+    static const size_t BATCH_SIZE = 64;
+
+    OrderEngine(DataStorage *dataStorage, size_t capacity = DEFAULT_CAPACITY);
+
+    OrderEngine(const OrderEngine &) = delete;
+
+    OrderEngine &operator=(const OrderEngine &) = delete;
+
+    uint32_t addNewLot(uint32_t startPrice, uint32_t ownerId, std::string description, uint32_t duration,
+                       uint32_t extension);
+
+    bool makeBet(uint32_t uid, const Bet &bet);
+
+    bool closeLot(uint32_t uid, uint32_t lotId);
+
+    uint32_t closeExpiredLots();
+
+    /*
+     * Applies commands already submitted and stops the thread.
+     * Nothing may be submitted after that.
+     */
+    void stop();
+
+    ~OrderEngine();
+
+private:
+    struct Completion {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        uint32_t result = 0;
+        std::string error;
+    };
+
+    struct Command {
+        enum Type {
+            ADD_NEW_LOT, MAKE_BET, CLOSE_LOT, CLOSE_EXPIRED_LOTS
+        };
+
+        Type type = ADD_NEW_LOT;
+        uint32_t uid = 0;
+        uint32_t startPrice = 0;
+        uint32_t lotId = 0;
+        uint32_t duration = 0;
+        uint32_t extension = 0;
+        Bet bet;
+        std::string description;
+        Completion *completion = nullptr;
+    };
+
+    DataStorage *dataStorage;
+    MpscRing<Command> commands;
+    std::thread thread;
+    std::atomic<bool> stopped;
+    std::atomic<bool> sleeping;
+    std::mutex sleepMtx;
+    std::condition_variable wakeUp;
+
+    uint32_t submit(Command &command);
+
+    void apply(Command &command);
+
+    void run();
+
+    static void runWrapper(OrderEngine *self) {
+        self->run();
+    }
+};
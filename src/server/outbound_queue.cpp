@@ -0,0 +1,87 @@
+#include <chrono>
+#include <stdexcept>
+#include "outbound_queue.h"
+
+
+void OutboundQueue::sendSome() {
+    sentOffset += sk->send_nonblocking(queued.data() + sentOffset, queued.size() - sentOffset);
+
+    if (sentOffset == queued.size()) {
+        queued.clear();
+        sentOffset = 0;
+    } else if (sentOffset >= limits.lowWatermark) {
+        /*
+         * отправленное начало выкидываем не каждый раз,
+         * а только когда оно стало заметным
+         */
+        queued.erase(0, sentOffset);
+        sentOffset = 0;
+    }
+}
+
+
+void OutboundQueue::drainTo(size_t watermark) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.slowConsumerTimeoutMs);
+
+    while (true) {
+        sendSome();
+        if (getQueuedSize() <= watermark)
+            break;
+
+        /*
+         * остаток округляем вверх, иначе последняя доля миллисекунды
+         * превращается в нулевое ожидание и соединение рвётся раньше срока
+         */
+        auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0 || !sk->wait_writable((int) ((left.count() + 999) / 1000)))
+            throw std::runtime_error("slow consumer: send queue isn't drained in time");
+    }
+
+    /*
+     * после больших ответов не держим память под очередь
+     */
+    if (queued.empty() && queued.capacity() > limits.highWatermark) {
+        std::string().swap(queued);
+        updateCharge();
+    }
+}
+
+
+void OutboundQueue::updateCharge() {
+    if (!budget || queued.capacity() == charged)
+        return;
+
+    if (queued.capacity() > charged)
+        budget->charge(MemoryLimits::CONNECTIONS, queued.capacity() - charged);
+    else
+        budget->release(MemoryLimits::CONNECTIONS, charged - queued.capacity());
+    charged = queued.capacity();
+}
+
+
+void OutboundQueue::send(const void *buf, size_t size) {
+    queued.append((const char *) buf, size);
+    updateCharge();
+
+    if (getQueuedSize() > limits.highWatermark)
+        drainTo(limits.lowWatermark);
+}
+
+
+void OutboundQueue::recv(void *buf, size_t size) {
+    flush();
+    sk->recv(buf, size);
+    received += size;
+}
+
+
+void OutboundQueue::flush() {
+    if (getQueuedSize())
+        drainTo(0);
+}
+
+
+OutboundQueue::~OutboundQueue() {
+    if (budget)
+        budget->release(MemoryLimits::CONNECTIONS, charged);
+}
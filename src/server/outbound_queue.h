@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include "../stream_socket.h"
+#include "memory_budget.h"
+
+
+/*
+ * Bounded outbound buffer of one connection, used as the socket the
+ * session writes to. Writes are collected in memory and go out with
+ * non-blocking sends, so a response costs one syscall instead of one
+ * per field.
+ *
+ * When more than highWatermark bytes are queued the session stops
+ * producing until the client takes the queue below lowWatermark.
+ * Before reading the next request everything is delivered.
+ * A client that doesn't take the queue down to the watermark within
+ * slowConsumerTimeoutMs is a slow consumer and is disconnected:
+ * the waiting call throws and the session ends, so neither memory
+ * nor the time a worker spends on one client is unbounded.
+ *
+ * The memory held by the queue is charged to the CONNECTIONS
+ * category of the budget if one is given.
+ */
+class OutboundQueue : public stream_socket {
+public:
+    struct Limits {
+        size_t lowWatermark = 64 * 1024;
+        size_t highWatermark = 256 * 1024;
+        int slowConsumerTimeoutMs = 5000;
+    };
+
+private:
+    stream_socket *sk;
+    Limits limits;
+    std::string queued;
+    size_t sentOffset = 0;
+    MemoryBudget *budget;
+    size_t charged = 0;
+    uint64_t received = 0;
+
+    void sendSome();
+
+    void updateCharge();
+
+    void drainTo(size_t watermark);
+
+public:
+    OutboundQueue(stream_socket *sk, const Limits &limits, MemoryBudget *budget = nullptr)
+            : sk(sk), limits(limits), budget(budget) {}
+
+    OutboundQueue(const OutboundQueue &) = delete;
+
+    OutboundQueue &operator=(const OutboundQueue &) = delete;
+
+    void send(const void *buf, size_t size) override;
+
+    /*
+     * Delivers everything queued before waiting for the peer.
+     */
+    void recv(void *buf, size_t size) override;
+
+    void flush() override;
+
+    size_t getQueuedSize() const {
+        return queued.size() - sentOffset;
+    }
+
+    /*
+     * Bytes received through the queue since the session started.
+     */
+    uint64_t getReceivedSize() const {
+        return received;
+    }
+
+    ~OutboundQueue();
+};
@@ -0,0 +1,53 @@
+#include "priority_mutex.h"
+
+
+void PriorityMutex::setUrgentPerBulk(unsigned urgentPerBulk) {
+    std::unique_lock<std::mutex> lock(mtx);
+    this->urgentPerBulk = urgentPerBulk;
+}
+
+
+void PriorityMutex::lock(Priority priority) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (!locked && !waiting[URGENT] && !waiting[BULK]) {
+        locked = true;
+        return;
+    }
+
+    ++waiting[priority];
+    std::condition_variable &myTurn = priority == URGENT ? urgentTurn : bulkTurn;
+    myTurn.wait(lock, [this, priority] { return !locked && turn == priority; });
+    --waiting[priority];
+    locked = true;
+}
+
+
+void PriorityMutex::unlock() {
+    std::unique_lock<std::mutex> lock(mtx);
+    locked = false;
+
+    if (waiting[URGENT] && (!waiting[BULK] || urgentStreak < urgentPerBulk)) {
+        turn = URGENT;
+        if (waiting[BULK])
+            ++urgentStreak;
+        lock.unlock();
+        urgentTurn.notify_one();
+    } else if (waiting[BULK]) {
+        turn = BULK;
+        urgentStreak = 0;
+        lock.unlock();
+        bulkTurn.notify_one();
+    }
+}
+
+
+bool PriorityMutex::try_lock() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (locked || waiting[URGENT] || waiting[BULK])
+        return false;
+
+    locked = true;
+    return true;
+}
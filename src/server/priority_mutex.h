@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+
+/*
+ * Mutex with two queues of waiters. On unlock it's handed to a waiting
+ * urgent locker first, but after urgentPerBulk urgent grants in a row
+ * with bulk lockers waiting the next one goes to a bulk locker,
+ * so bulk work gets a guaranteed but bounded share under overload.
+ * When nobody waits, lock costs one uncontended std::mutex round trip.
+ */
+class PriorityMutex {
+public:
+    enum Priority {
+        URGENT,
+        BULK
+    };
+
+    static const unsigned DEFAULT_URGENT_PER_BULK = 8;
+
+    explicit PriorityMutex(unsigned urgentPerBulk = DEFAULT_URGENT_PER_BULK) : urgentPerBulk(urgentPerBulk) {}
+
+    void setUrgentPerBulk(unsigned urgentPerBulk);
+
+    void lock(Priority priority = URGENT);
+
+    void unlock();
+
+    bool try_lock();
+
+private:
+    std::mutex mtx;
+    std::condition_variable urgentTurn;
+    std::condition_variable bulkTurn;
+    bool locked = false;
+    Priority turn = URGENT;
+    size_t waiting[2] = {0, 0};
+    unsigned urgentStreak = 0;
+    unsigned urgentPerBulk;
+};
@@ -0,0 +1,64 @@
+#include <algorithm>
+#include "rate_limiter.h"
+
+
+TokenBucket::TokenBucket(const RateLimit &limit)
+        : limit(limit), tokens(limit.burst), lastRefill(std::chrono::steady_clock::now()) {}
+
+
+bool TokenBucket::refill(std::chrono::steady_clock::time_point now) {
+    if (limit.perSecond <= 0)
+        return true;
+
+    std::chrono::duration<double> elapsed = now - lastRefill;
+    tokens = std::min(limit.burst, tokens + elapsed.count() * limit.perSecond);
+    lastRefill = now;
+
+    return tokens >= 1;
+}
+
+
+void TokenBucket::take() {
+    if (limit.perSecond > 0)
+        tokens -= 1;
+}
+
+
+RateLimiter::RateLimiter(const RateLimits &limits) : total(limits.total) {
+    for (auto i = limits.perType.begin(); i != limits.perType.end(); ++i)
+        perType.emplace(i->first, TokenBucket(i->second));
+}
+
+
+bool RateLimiter::admit(Body::BodyType type) {
+    if (type == Body::BodyType::BYE)
+        return true;
+
+    /*
+     * лоты с таймером и условные запросы расходуют токены своих обычных запросов
+     */
+    if (type == Body::BodyType::NEW_TIMED_LOT_REQ)
+        type = Body::BodyType::NEW_LOT_REQ;
+    else if (type == Body::BodyType::CONDITIONAL_LIST_LOTS_REQ)
+        type = Body::BodyType::LIST_LOTS_REQ;
+    else if (type == Body::BodyType::CONDITIONAL_LOT_DET_REQ)
+        type = Body::BodyType::LOT_DET_REQ;
+
+    auto now = std::chrono::steady_clock::now();
+    auto typeBucket = perType.find(type);
+
+    /*
+     * пополняем оба ведра до проверки, чтобы отклонённый запрос
+     * не забрал токен ни из одного из них
+     */
+    bool typeAdmits = typeBucket == perType.end() || typeBucket->second.refill(now);
+    bool totalAdmits = total.refill(now);
+    if (!typeAdmits || !totalAdmits)
+        return false;
+
+    if (typeBucket != perType.end())
+        typeBucket->second.take();
+    total.take();
+
+    return true;
+}
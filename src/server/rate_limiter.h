@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include "../protocol.h"
+
+
+/*
+ * perSecond tokens are added every second up to burst,
+ * perSecond == 0 means no limit.
+ */
+struct RateLimit {
+    double perSecond = 0;
+    double burst = 0;
+};
+
+
+/*
+ * total limits all the requests of a user, perType limits requests
+ * of one type. Bye is never limited.
+ */
+struct RateLimits {
+    RateLimit total;
+    std::map<Body::BodyType, RateLimit> perType;
+};
+
+
+class TokenBucket {
+    RateLimit limit;
+    double tokens;
+    std::chrono::steady_clock::time_point lastRefill;
+
+public:
+    TokenBucket(const RateLimit &limit = RateLimit());
+
+    /*
+     * Adds the tokens earned since the last call,
+     * returns true if there is a whole token.
+     */
+    bool refill(std::chrono::steady_clock::time_point now);
+
+    void take();
+};
+
+
+/*
+ * Admission control of one session, so it's used by one thread and
+ * needs no locking. A request is admitted only if both its type bucket
+ * and the total bucket have a token, rejected requests take nothing.
+ */
+class RateLimiter {
+    TokenBucket total;
+    std::map<Body::BodyType, TokenBucket> perType;
+
+public:
+    explicit RateLimiter(const RateLimits &limits);
+
+    bool admit(Body::BodyType type);
+};
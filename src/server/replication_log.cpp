@@ -0,0 +1,46 @@
+#include <chrono>
+#include "replication_log.h"
+
+
+void ReplicationLog::append(const Mutation &mutation) {
+    std::lock_guard<std::mutex> lock(mtx);
+    mutations.push_back(mutation);
+
+    /*
+     * будим только тех, кто ждёт, запись идёт под блокировкой хранилища
+     */
+    if (waiting > 0)
+        appended.notify_all();
+}
+
+
+uint64_t ReplicationLog::size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return mutations.size();
+}
+
+
+bool ReplicationLog::read(uint64_t from, size_t limit, int timeoutMs, std::list<Mutation> &out) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (!closed && from >= mutations.size()) {
+        ++waiting;
+        appended.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                          [this, from] { return closed || from < mutations.size(); });
+        --waiting;
+    }
+
+    if (closed)
+        return false;
+
+    for (uint64_t i = from; i < mutations.size() && i - from < limit; ++i)
+        out.push_back(mutations[i]);
+    return true;
+}
+
+
+void ReplicationLog::close() {
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = true;
+    appended.notify_all();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include "../protocol.h"
+
+
+/*
+ * Every mutation of a DataStorage in the order it was applied,
+ * numbered from 0, so a follower can start from any of them.
+ * Lots and bets are never removed, so neither are mutations:
+ * the log stays about as large as the state itself.
+ * Descriptions are kept as references into the storage's arena.
+ * Appended under the storage lock, read under the log's own one.
+ */
+class ReplicationLog {
+    std::mutex mtx;
+    std::condition_variable appended;
+    std::deque<Mutation> mutations;
+    size_t waiting = 0;
+    bool closed = false;
+
+public:
+    void append(const Mutation &mutation);
+
+    uint64_t size();
+
+    /*
+     * Waits up to timeoutMs for mutations starting from from,
+     * appends at most limit of them to out.
+     * Returns false once the log is closed.
+     */
+    bool read(uint64_t from, size_t limit, int timeoutMs, std::list<Mutation> &out);
+
+    /*
+     * Wakes and ends all readers.
+     */
+    void close();
+};
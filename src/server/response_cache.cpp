@@ -0,0 +1,38 @@
+#include "response_cache.h"
+
+
+ResponseCache::Buffer ResponseCache::find(uint32_t key, uint64_t version, unsigned variant) {
+    Stripe &stripe = stripes[key % STRIPES];
+    std::lock_guard<std::mutex> lock(stripe.mtx);
+
+    auto found = stripe.entries.find(key);
+    if (found == stripe.entries.end() || found->second.version != version)
+        return Buffer();
+    return found->second.variants[variant];
+}
+
+
+void ResponseCache::store(uint32_t key, uint64_t version, unsigned variant, Buffer buffer) {
+    Stripe &stripe = stripes[key % STRIPES];
+    std::lock_guard<std::mutex> lock(stripe.mtx);
+
+    auto found = stripe.entries.find(key);
+    if (found == stripe.entries.end()) {
+        if (stripe.entries.size() >= MAX_STRIPE_ENTRIES)
+            stripe.entries.clear();
+        found = stripe.entries.emplace(key, Entry()).first;
+    }
+
+    Entry &entry = found->second;
+    /*
+     * буфер, собранный по более старой версии, уже никому не нужен
+     */
+    if (version < entry.version)
+        return;
+    if (version > entry.version) {
+        entry.version = version;
+        for (unsigned i = 0; i < VARIANTS; ++i)
+            entry.variants[i].reset();
+    }
+    entry.variants[variant] = buffer;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+
+/*
+ * Responses already encoded for the wire, shared by all connections.
+ * An entry is a response for some key (the listing or a lot) as of
+ * some version of it, encoded in up to VARIANTS ways (compact and
+ * compressed or not). A buffer is only found for the version it was
+ * built for, so a mutation bumping the version invalidates it, and an
+ * entry is replaced by the first buffer built for a newer version.
+ * Entries are spread over stripes with their own locks; a stripe
+ * holding too many entries is emptied.
+ */
+class ResponseCache {
+public:
+    typedef std::shared_ptr<const std::string> Buffer;
+
+    static const unsigned VARIANTS = 4;
+    static const size_t STRIPES = 64;
+    static const size_t MAX_STRIPE_ENTRIES = 1024;
+
+    /*
+     * Returns null if there is no buffer for that version.
+     */
+    Buffer find(uint32_t key, uint64_t version, unsigned variant);
+
+    void store(uint32_t key, uint64_t version, unsigned variant, Buffer buffer);
+
+private:
+    struct Entry {
+        uint64_t version = 0;
+        Buffer variants[VARIANTS];
+    };
+
+    struct Stripe {
+        std::mutex mtx;
+        std::unordered_map<uint32_t, Entry> entries;
+    };
+
+    Stripe stripes[STRIPES];
+};
@@ -1,17 +1,232 @@
+#include <signal.h>
+#include <cstdio>
+#include <cstring>
 #include "trade_server.h"
 
 static const char *QUIT = "q";
+static const char *LOCK_PROFILE = "l";
+static const char *LOCK_PROFILE_RESET = "lr";
+static const char *SESSIONS = "s";
+static const char *MEMORY = "m";
+
+static const char *USAGE =
+        "usage: server [ip] [port] [options]\n"
+        "--workers=<n> - threads serving sessions\n"
+        "--max-sessions=<n> - concurrent sessions limit, extra connections are refused\n"
+        "--acceptors=<n> - threads accepting connections, each with its own SO_REUSEPORT socket\n"
+        "--backlog=<n> - listen backlog of every acceptor socket\n"
+        "--io=<blocking|uring> - syscalls per operation or batched io_uring submissions\n"
+        "--unix=<path> - also listen on a unix socket for local clients\n"
+        "--shm=<path> - also serve local clients through shared memory, handshake on a unix socket at path\n"
+        "--shm-busy-poll - shared memory sides spin instead of sleeping, burns a core per session\n"
+        "--send-high-watermark=<bytes> - queued output size at which a session waits for its client\n"
+        "--send-low-watermark=<bytes> - queued output size at which the session goes on\n"
+        "--slow-consumer-timeout=<ms> - clients not reading their output for that long are disconnected\n"
+        "--rate-limit=<request>:<per second>:<burst> - token bucket of every user for a request type,\n"
+        "    request is one of all, new-lot, list, details, bet, close, query, search, aggregate; may be repeated\n"
+        "--urgent-per-bulk=<n> - bets and other updates served ahead of a waiting listing or details read\n"
+        "--huge-pages - keep lot descriptions in memory backed by transparent huge pages\n"
+        "--engine - apply new lots, bets and closes on a single engine thread in submission order\n"
+        "--engine-queue=<slots> - engine command ring size, a power of two\n"
+        "--strict-bets - accept only bets beating the current best one\n"
+        "--replication-log - record all changes so that followers can replicate this server\n"
+        "--follow=<ip> - be a read-only follower of the server at ip, serving reads from a local copy\n"
+        "--follow-port=<port> - port of the followed server\n"
+        "--max-staleness=<ms> - a follower refuses reads when its primary is silent for that long\n"
+        "--memory-limit=<category>:<bytes> - memory budget of connections, requests, storage or total,\n"
+        "    sessions, requests and new lots and bets over it are refused, 'm' on stdin shows the usage\n"
+        "--max-string=<bytes> - longest string a peer may send\n"
+        "--max-list=<n> - most elements of a list a peer may send\n"
+        "--max-frame=<bytes> - largest frame a peer may send, compressed or not\n"
+        "--capture=<path> - record every inbound message of every session for the replay tool\n"
+        "--shard=<index>/<count> - serve one of count shards of the auction, index is from 0,\n"
+        "    clients list all the shards as <ip>:<port>,<ip>:<port>,...\n";
+
+static const std::map<std::string, Body::BodyType> RATE_LIMITED_REQUESTS = {
+        {"new-lot", Body::BodyType::NEW_LOT_REQ},
+        {"list",    Body::BodyType::LIST_LOTS_REQ},
+        {"details", Body::BodyType::LOT_DET_REQ},
+        {"bet",     Body::BodyType::MAKE_BET_REQ},
+        {"close",   Body::BodyType::CLOSE_LOT_REQ},
+        {"query",   Body::BodyType::QUERY_LOTS_REQ},
+        {"search",  Body::BodyType::SEARCH_REQ},
+        {"aggregate", Body::BodyType::AGGREGATE_REQ},
+};
+
+
+/*
+ * SIGUSR1 dumps the lock profile to stderr.
+ * The signal is blocked in all threads and consumed synchronously here,
+ * so the report isn't printed from a signal handler.
+ */
+static void reportOnSignal(sigset_t signals) {
+    int signal;
+    while (sigwait(&signals, &signal) == 0)
+        LockProfiler::instance().report(std::cerr);
+}
+
+
+static bool parseOption(const char *arg, const char *name, const char *&value) {
+    size_t nameLen = strlen(name);
+    if (strncmp(arg, name, nameLen) != 0 || arg[nameLen] != '=')
+        return false;
+    value = arg + nameLen + 1;
+    return true;
+}
+
+
+static bool parseRateLimit(const char *value, RateLimits &limits) {
+    char request[16];
+    RateLimit limit;
+
+    if (sscanf(value, "%15[^:]:%lf:%lf", request, &limit.perSecond, &limit.burst) != 3
+        || limit.perSecond <= 0 || limit.burst < 1)
+        return false;
+
+    if (strcmp(request, "all") == 0) {
+        limits.total = limit;
+        return true;
+    }
+
+    auto type = RATE_LIMITED_REQUESTS.find(request);
+    if (type == RATE_LIMITED_REQUESTS.end())
+        return false;
+    limits.perType[type->second] = limit;
+    return true;
+}
+
+
+static bool parseMemoryLimit(const char *value, MemoryLimits &limits) {
+    char category[16];
+    size_t bytes;
+
+    if (sscanf(value, "%15[^:]:%zu", category, &bytes) != 2)
+        return false;
+
+    if (strcmp(category, "total") == 0) {
+        limits.total = bytes;
+        return true;
+    }
+
+    for (int i = 0; i < MemoryLimits::CATEGORIES; ++i) {
+        if (strcmp(category, MemoryLimits::getName((MemoryLimits::Category) i)) == 0) {
+            limits.perCategory[i] = bytes;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool parseConfig(int argc, char **argv, ServerConfig &config) {
+    int positional = 0;
+    bool maxSessionsSet = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *value;
+
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (positional == 0)
+                config.ip = argv[i];
+            else if (positional == 1)
+                config.port = atoi(argv[i]);
+            else
+                return false;
+            ++positional;
+        } else if (parseOption(argv[i], "--workers", value)) {
+            config.workers = atoi(value);
+        } else if (parseOption(argv[i], "--max-sessions", value)) {
+            config.maxSessions = atoi(value);
+            maxSessionsSet = true;
+        } else if (parseOption(argv[i], "--acceptors", value)) {
+            config.acceptors = atoi(value);
+        } else if (parseOption(argv[i], "--backlog", value)) {
+            config.backlog = atoi(value);
+        } else if (parseOption(argv[i], "--io", value)) {
+            if (strcmp(value, "uring") == 0)
+                config.uring = true;
+            else if (strcmp(value, "blocking") == 0)
+                config.uring = false;
+            else
+                return false;
+        } else if (parseOption(argv[i], "--unix", value)) {
+            config.unixPath = value;
+        } else if (parseOption(argv[i], "--shm", value)) {
+            config.shmPath = value;
+        } else if (strcmp(argv[i], "--shm-busy-poll") == 0) {
+            config.shmBusyPoll = true;
+        } else if (parseOption(argv[i], "--send-high-watermark", value)) {
+            config.sendQueue.highWatermark = atoi(value);
+        } else if (parseOption(argv[i], "--send-low-watermark", value)) {
+            config.sendQueue.lowWatermark = atoi(value);
+        } else if (parseOption(argv[i], "--slow-consumer-timeout", value)) {
+            config.sendQueue.slowConsumerTimeoutMs = atoi(value);
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            config.hugePages = true;
+        } else if (strcmp(argv[i], "--engine") == 0) {
+            config.engine = true;
+        } else if (parseOption(argv[i], "--engine-queue", value)) {
+            config.engineQueue = atoi(value);
+        } else if (strcmp(argv[i], "--strict-bets") == 0) {
+            config.strictBets = true;
+        } else if (parseOption(argv[i], "--shard", value)) {
+            if (sscanf(value, "%u/%u", &config.shard, &config.shards) != 2)
+                return false;
+        } else if (parseOption(argv[i], "--capture", value)) {
+            config.capturePath = value;
+        } else if (strcmp(argv[i], "--replication-log") == 0) {
+            config.replicationLog = true;
+        } else if (parseOption(argv[i], "--follow", value)) {
+            config.followAddr = value;
+        } else if (parseOption(argv[i], "--follow-port", value)) {
+            config.followPort = atoi(value);
+        } else if (parseOption(argv[i], "--max-staleness", value)) {
+            config.maxStalenessMs = atoi(value);
+        } else if (parseOption(argv[i], "--urgent-per-bulk", value)) {
+            config.urgentPerBulk = atoi(value);
+        } else if (parseOption(argv[i], "--rate-limit", value)) {
+            if (!parseRateLimit(value, config.rateLimits))
+                return false;
+        } else if (parseOption(argv[i], "--memory-limit", value)) {
+            if (!parseMemoryLimit(value, config.memoryLimits))
+                return false;
+        } else if (parseOption(argv[i], "--max-string", value)) {
+            config.decodeLimits.max_string = strtoul(value, nullptr, 10);
+        } else if (parseOption(argv[i], "--max-list", value)) {
+            config.decodeLimits.max_list = strtoul(value, nullptr, 10);
+        } else if (parseOption(argv[i], "--max-frame", value)) {
+            config.decodeLimits.max_frame = strtoul(value, nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+
+    if (!maxSessionsSet)
+        config.maxSessions = config.workers;
+
+    return config.workers > 0 && config.maxSessions > 0 && config.acceptors > 0 && config.backlog > 0
+           && config.sendQueue.lowWatermark <= config.sendQueue.highWatermark
+           && config.sendQueue.slowConsumerTimeoutMs > 0
+           && config.engineQueue > 0 && (config.engineQueue & (config.engineQueue - 1)) == 0
+           && config.shards > 0 && config.shard < config.shards;
+}
+
 
 int main(int argc, char** argv) {
-    const char* ip = DEFAULT_ADDR;
-    tcp_port port = DEFAULT_PORT;
+    ServerConfig config;
+
+    if (!parseConfig(argc, argv, config)) {
+        std::cerr << USAGE;
+        return 1;
+    }
 
-    if (argc > 2)
-        port = atoi(argv[2]);
-    if (argc > 1)
-        ip = argv[1];
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::thread(reportOnSignal, signals).detach();
 
-    TradeServer tradeServer(ip, port);
+    TradeServer tradeServer(config);
     tradeServer.start();
 
     std::string input;
@@ -19,6 +234,14 @@ int main(int argc, char** argv) {
         std::getline(std::cin, input);
         if (input == QUIT)
             break;
+        if (input == LOCK_PROFILE)
+            LockProfiler::instance().report(std::cerr);
+        if (input == LOCK_PROFILE_RESET)
+            LockProfiler::instance().reset();
+        if (input == SESSIONS)
+            std::cerr << "active sessions: " << tradeServer.getActiveSessions() << '\n';
+        if (input == MEMORY)
+            tradeServer.getMemoryBudget().report(std::cerr);
     }
 
     return 0;
@@ -0,0 +1,97 @@
+#include <sys/mman.h>
+#include <cstring>
+#include <new>
+#include "string_arena.h"
+
+
+char *StringArena::allocateChunk(size_t size) {
+    char *chunk;
+
+    if (hugePages) {
+        void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        madvise(mapped, size, MADV_HUGEPAGE);
+#endif
+        chunk = (char *) mapped;
+    } else {
+        chunk = new char[size];
+    }
+
+    chunks.push_back(std::make_pair(chunk, size));
+    return chunk;
+}
+
+
+TextRef StringArena::store(const char *data, uint32_t size) {
+    char *stored;
+
+    if (size > CHUNK_SIZE / 4) {
+        /*
+         * длинные строки получают свой кусок,
+         * чтобы не выбрасывать остаток текущего
+         */
+        stored = allocateChunk(size);
+    } else {
+        if (size > left || !current) {
+            current = allocateChunk(CHUNK_SIZE);
+            left = CHUNK_SIZE;
+        }
+        stored = current;
+        current += size;
+        left -= size;
+    }
+
+    memcpy(stored, data, size);
+    return TextRef(stored, size);
+}
+
+
+size_t StringArena::getReservedBytes() const {
+    size_t total = 0;
+    for (auto i = chunks.begin(); i != chunks.end(); ++i)
+        total += i->second;
+    return total;
+}
+
+
+StringArena::~StringArena() {
+    for (auto i = chunks.begin(); i != chunks.end(); ++i) {
+        if (hugePages)
+            munmap(i->first, i->second);
+        else
+            delete[] i->first;
+    }
+}
+
+
+size_t StringInterner::Hash::operator()(const TextRef &text) const {
+    /*
+     * FNV-1a
+     */
+    size_t hash = 2166136261u;
+    for (uint32_t i = 0; i < text.size; ++i) {
+        hash ^= (unsigned char) text.data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+bool StringInterner::Equal::operator()(const TextRef &a, const TextRef &b) const {
+    return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+}
+
+
+TextRef StringInterner::intern(const std::string &str) {
+    TextRef key(str.data(), (uint32_t) str.size());
+
+    auto found = strings.find(key);
+    if (found != strings.end())
+        return *found;
+
+    TextRef stored = arena.store(key.data, key.size);
+    strings.insert(stored);
+    return stored;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "../protocol.h"
+
+
+/*
+ * Append-only storage for strings living as long as the arena:
+ * memory is taken from large chunks and never freed one by one,
+ * so there is no allocator call and no header per string.
+ * With hugePages chunks are mmap'ed and advised to be backed
+ * by transparent huge pages.
+ */
+class StringArena {
+    bool hugePages;
+    std::vector<std::pair<char *, size_t>> chunks;
+    char *current = nullptr;
+    size_t left = 0;
+
+    char *allocateChunk(size_t size);
+
+public:
+    static const size_t CHUNK_SIZE = 2 * 1024 * 1024;
+
+    explicit StringArena(bool hugePages = false) : hugePages(hugePages) {}
+
+    StringArena(const StringArena &) = delete;
+
+    StringArena &operator=(const StringArena &) = delete;
+
+    TextRef store(const char *data, uint32_t size);
+
+    size_t getReservedBytes() const;
+
+    ~StringArena();
+};
+
+
+/*
+ * Keeps a single copy of every distinct string in an arena.
+ * Not thread-safe, the owner locks it.
+ */
+class StringInterner {
+    struct Hash {
+        size_t operator()(const TextRef &text) const;
+    };
+
+    struct Equal {
+        bool operator()(const TextRef &a, const TextRef &b) const;
+    };
+
+    StringArena arena;
+    std::unordered_set<TextRef, Hash, Equal> strings;
+
+public:
+    explicit StringInterner(bool hugePages = false) : arena(hugePages) {}
+
+    TextRef intern(const std::string &str);
+
+    size_t getCount() const {
+        return strings.size();
+    }
+
+    size_t getReservedBytes() const {
+        return arena.getReservedBytes();
+    }
+};
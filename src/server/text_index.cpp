@@ -0,0 +1,224 @@
+#include <algorithm>
+#include "text_index.h"
+
+
+static bool isWordChar(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+
+std::vector<std::string> TextIndex::tokenize(const std::string &text) {
+    std::vector<std::string> words;
+    std::string word;
+
+    for (size_t i = 0; i <= text.size(); ++i) {
+        unsigned char c = i < text.size() ? text[i] : ' ';
+
+        if (isWordChar(c)) {
+            word.push_back((char) (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c));
+        } else if (!word.empty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+
+    return words;
+}
+
+
+void TextIndex::add(uint32_t id, const std::string &text) {
+    std::vector<std::string> words = tokenize(text);
+
+    for (auto i = words.begin(); i != words.end(); ++i) {
+        std::vector<uint32_t> &ids = postings[*i];
+
+        /*
+         * новые лоты почти всегда получают наибольший id,
+         * так что обычно это просто добавление в конец
+         */
+        if (ids.empty() || ids.back() < id)
+            ids.push_back(id);
+        else {
+            auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+            if (*pos != id)
+                ids.insert(pos, id);
+        }
+    }
+}
+
+
+typedef std::vector<uint32_t>::const_iterator PostingIt;
+
+
+/*
+ * Posting lists of all the words with a prefix, never merged in full:
+ * next() walks their union in increasing order through a heap,
+ * contains() probes each list for ids that grow between the calls.
+ */
+struct TextIndex::PrefixCursor {
+    typedef std::pair<PostingIt, PostingIt> Range;
+
+    std::vector<Range> ranges;
+    size_t total = 0;
+    bool merging = false;
+    bool started = false;
+    uint32_t last = 0;
+
+    static bool greater(const Range &a, const Range &b) {
+        return *a.first > *b.first;
+    }
+
+    bool next(uint32_t &id) {
+        if (!merging) {
+            std::make_heap(ranges.begin(), ranges.end(), greater);
+            merging = true;
+        }
+
+        while (!ranges.empty()) {
+            std::pop_heap(ranges.begin(), ranges.end(), greater);
+            Range &range = ranges.back();
+            uint32_t value = *range.first;
+
+            if (++range.first == range.second)
+                ranges.pop_back();
+            else
+                std::push_heap(ranges.begin(), ranges.end(), greater);
+
+            if (!started || value != last) {
+                started = true;
+                last = id = value;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool contains(uint32_t id) {
+        bool found = false;
+
+        for (size_t i = 0; i < ranges.size();) {
+            Range &range = ranges[i];
+            range.first = std::lower_bound(range.first, range.second, id);
+
+            /*
+             * исчерпанный список больше ничего не найдёт, убираем его
+             */
+            if (range.first == range.second) {
+                range = ranges.back();
+                ranges.pop_back();
+                continue;
+            }
+
+            found = found || *range.first == id;
+            ++i;
+        }
+
+        return found;
+    }
+};
+
+
+TextIndex::PrefixCursor TextIndex::openPrefix(const std::string &prefix) const {
+    PrefixCursor cursor;
+
+    for (auto i = postings.lower_bound(prefix); i != postings.end(); ++i) {
+        if (i->first.compare(0, prefix.size(), prefix) != 0)
+            break;
+        cursor.ranges.push_back(PrefixCursor::Range(i->second.begin(), i->second.end()));
+        cursor.total += i->second.size();
+    }
+
+    return cursor;
+}
+
+
+std::vector<uint32_t> TextIndex::search(const std::string &query, size_t limit) const {
+    /*
+     * разбираем запрос тем же токенизатором, но помним,
+     * за какими словами стояла звёздочка
+     */
+    std::vector<std::pair<std::string, bool>> terms;
+    std::string word;
+
+    for (size_t i = 0; i <= query.size(); ++i) {
+        unsigned char c = i < query.size() ? query[i] : ' ';
+
+        if (isWordChar(c)) {
+            word.push_back((char) (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c));
+        } else if (!word.empty()) {
+            terms.push_back(std::make_pair(word, c == '*'));
+            word.clear();
+        }
+    }
+
+    std::vector<const std::vector<uint32_t> *> lists;
+    std::vector<PrefixCursor> prefixes;
+    std::vector<uint32_t> result;
+
+    for (auto i = terms.begin(); i != terms.end(); ++i) {
+        if (i->second) {
+            prefixes.push_back(openPrefix(i->first));
+        } else {
+            auto exact = postings.find(i->first);
+            if (exact == postings.end())
+                return result;
+            lists.push_back(&exact->second);
+        }
+    }
+
+    if (terms.empty())
+        return result;
+
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<uint32_t> *a, const std::vector<uint32_t> *b) { return a->size() < b->size(); });
+
+    size_t driver = 0;
+    for (size_t i = 1; i < prefixes.size(); ++i)
+        if (prefixes[i].total < prefixes[driver].total)
+            driver = i;
+
+    /*
+     * идём по самому короткому источнику и ищем каждый id в остальных,
+     * так время зависит от него, а не от размера каталога;
+     * префикс ведёт, только если все его списки вместе короче точного
+     */
+    bool fromPrefix = !prefixes.empty() && (lists.empty() || prefixes[driver].total < lists[0]->size());
+    size_t firstProbed = fromPrefix ? 0 : 1;
+
+    std::vector<PostingIt> from;
+    for (size_t i = 0; i < lists.size(); ++i)
+        from.push_back(lists[i]->begin());
+
+    while (true) {
+        uint32_t id;
+        if (fromPrefix) {
+            if (!prefixes[driver].next(id))
+                break;
+        } else {
+            if (from[0] == lists[0]->end())
+                break;
+            id = *from[0]++;
+        }
+
+        bool matches = true;
+
+        for (size_t i = firstProbed; i < lists.size() && matches; ++i) {
+            from[i] = std::lower_bound(from[i], lists[i]->end(), id);
+            matches = from[i] != lists[i]->end() && *from[i] == id;
+        }
+
+        for (size_t i = 0; i < prefixes.size() && matches; ++i)
+            if (!fromPrefix || i != driver)
+                matches = prefixes[i].contains(id);
+
+        if (!matches)
+            continue;
+
+        result.push_back(id);
+        if (limit && result.size() == limit)
+            break;
+    }
+
+    return result;
+}
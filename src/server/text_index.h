@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+/*
+ * Inverted index from words to sorted lists of lot ids.
+ * Words are maximal runs of letters and digits, ASCII letters are
+ * lowercased, bytes above 0x7f are kept as letters so UTF-8 words
+ * are indexed as they are.
+ *
+ * A query is a list of words, a lot matches if it has all of them.
+ * A word ending with '*' matches any word with that prefix.
+ * Not thread-safe, the owner locks it.
+ */
+class TextIndex {
+    std::map<std::string, std::vector<uint32_t>> postings;
+
+    struct PrefixCursor;
+
+    PrefixCursor openPrefix(const std::string &prefix) const;
+
+public:
+    static std::vector<std::string> tokenize(const std::string &text);
+
+    void add(uint32_t id, const std::string &text);
+
+    /*
+     * Returns at most limit ids in increasing order, limit 0 means all.
+     */
+    std::vector<uint32_t> search(const std::string &query, size_t limit) const;
+};
@@ -0,0 +1,94 @@
+#include "timer_wheel.h"
+
+
+TimerWheel::TimerWheel(uint64_t now) : current(now) {
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        for (uint64_t slot = 0; slot < SLOTS; ++slot) {
+            Timer *head = &slots[level][slot];
+            head->prev = head->next = head;
+        }
+    }
+}
+
+
+void TimerWheel::insert(Timer *timer) {
+    /*
+     * слишком далёкие таймеры ждут на верхнем уровне
+     * и спускаются при его обороте
+     */
+    uint64_t at = timer->expiry > current ? timer->expiry : current;
+    uint64_t delta = at - current;
+    if (delta >= SLOTS << (LEVEL_BITS * (LEVELS - 1)))
+        at = current + (SLOTS << (LEVEL_BITS * (LEVELS - 1))) - 1;
+
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delta >= SLOTS << (LEVEL_BITS * level))
+        ++level;
+
+    Timer *head = &slots[level][(at >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+
+void TimerWheel::schedule(Timer *timer, uint64_t expiry) {
+    cancel(timer);
+    /*
+     * слот текущего тика уже обработан
+     */
+    timer->expiry = expiry > current ? expiry : current + 1;
+    insert(timer);
+    ++count;
+}
+
+
+void TimerWheel::cancel(Timer *timer) {
+    if (!timer->isScheduled())
+        return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = nullptr;
+    --count;
+}
+
+
+void TimerWheel::cascade(unsigned level) {
+    Timer *head = &slots[level][(current >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+    Timer *timer = head->next;
+    head->prev = head->next = head;
+
+    while (timer != head) {
+        Timer *next = timer->next;
+        insert(timer);
+        timer = next;
+    }
+}
+
+
+void TimerWheel::advance(uint64_t now, std::vector<uint32_t> &expired) {
+    /*
+     * пустое колесо переводим сразу, а не по одному тику
+     */
+    if (count == 0 && current < now)
+        current = now;
+
+    while (current < now) {
+        ++current;
+
+        for (unsigned level = 1; level < LEVELS; ++level) {
+            if ((current & ((1ull << (LEVEL_BITS * level)) - 1)) != 0)
+                break;
+            cascade(level);
+        }
+
+        Timer *head = &slots[0][current & (SLOTS - 1)];
+        while (head->next != head) {
+            Timer *timer = head->next;
+            cancel(timer);
+            expired.push_back(timer->id);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+/*
+ * Hierarchical timer wheel: LEVELS wheels of SLOTS lists each,
+ * a slot of level n covers SLOTS^n ticks. Timers are intrusive list nodes
+ * owned by the caller, so scheduling and cancelling are O(1) and allocate
+ * nothing. Timers of upper levels move down when the wheel below wraps,
+ * timers further than the whole wheel wait in the top level.
+ * Not thread-safe, the owner locks it.
+ */
+class TimerWheel {
+public:
+    static const unsigned LEVEL_BITS = 6;
+    static const unsigned LEVELS = 4;
+    static const uint64_t SLOTS = 1u << LEVEL_BITS;
+
+    struct Timer {
+        uint64_t expiry = 0;
+        uint32_t id = 0;
+        Timer *prev = nullptr;
+        Timer *next = nullptr;
+
+        bool isScheduled() const {
+            return next != nullptr;
+        }
+    };
+
+    explicit TimerWheel(uint64_t now = 0);
+
+    TimerWheel(const TimerWheel &) = delete;
+
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    uint64_t getCurrent() const {
+        return current;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    /*
+     * Schedules or reschedules the timer, an expiry in the past
+     * fires on the next tick.
+     */
+    void schedule(Timer *timer, uint64_t expiry);
+
+    void cancel(Timer *timer);
+
+    /*
+     * Moves the wheel to now and appends ids of all expired timers,
+     * they are unscheduled.
+     */
+    void advance(uint64_t now, std::vector<uint32_t> &expired);
+
+private:
+    Timer slots[LEVELS][SLOTS];
+    uint64_t current;
+    size_t count = 0;
+
+    void insert(Timer *timer);
+
+    void cascade(unsigned level);
+};
@@ -1,14 +1,48 @@
 #include <algorithm>
 #include <iostream>
+#include <iterator>
+#include "../buffer_stream.h"
 #include "trade_server.h"
 
 
+/*
+ * Listings and details can be large, they are compressed if the client agreed to it.
+ * Bets and statuses are always written as is.
+ */
+static void writeLargeResponse(Packet &response, stream_socket *sk, TradeConnection::Context *context) {
+    if (context->hasFeature(FEATURE_COMPRESSION))
+        response.writeCompressedToStreamSocket(sk);
+    else
+        response.writeToStreamSocket(sk);
+}
+
+
+/*
+ * Cached responses are kept in every encoding the clients agreed to,
+ * see ResponseCache. The listing is cached under key 0, lots under their ids.
+ */
+static const uint32_t LISTING_KEY = 0;
+
+
+static unsigned responseVariant(TradeConnection::Context *context) {
+    return (context->hasFeature(FEATURE_COMPACT_ENCODING) ? 1 : 0) | (context->hasFeature(FEATURE_COMPRESSION) ? 2 : 0);
+}
+
+
+static ResponseCache::Buffer encodeResponse(Packet &response, TradeConnection::Context *context) {
+    buffer_stream encoded;
+    writeLargeResponse(response, &encoded, context);
+    return std::make_shared<const std::string>(encoded.take_data());
+}
+
+
 static void newLotRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
     std::cerr << context->getUid() << ":" << "new lot request handler\n";
 
     NewLotRequest *request = (NewLotRequest *) packet->getBody();
     uint32_t lotId = context->getDataStorage()->addNewLot(request->getStartPrice(), context->getUid(),
-                                                          request->getDescription());
+                                                          request->getDescription(), request->getDuration(),
+                                                          request->getExtension());
     Packet::constructNewLotResponse(lotId).writeToStreamSocket(sk);
 }
 
@@ -16,7 +50,28 @@ static void newLotRequestHandler(stream_socket *sk, Packet *packet, TradeConnect
 static void listLotsRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
     std::cerr << context->getUid() << ":" << "list lots request handler\n";
 
-    Packet::constructListLotsResponse(context->getDataStorage()->getShortInfoList()).writeToStreamSocket(sk);
+    ListLotsRequest *request = (ListLotsRequest *) packet->getBody();
+    DataStorage *dataStorage = context->getDataStorage();
+    ResponseCache &cache = dataStorage->getResponseCache();
+    unsigned variant = responseVariant(context);
+
+    uint64_t version = dataStorage->getListingVersion();
+    if (request->isConditional() && request->getKnownVersion() == version) {
+        Packet::constructResourceVersion(version, false).writeToStreamSocket(sk);
+        return;
+    }
+
+    ResponseCache::Buffer encoded = cache.find(LISTING_KEY, version, variant);
+    if (!encoded) {
+        Packet response = Packet::constructListLotsResponse(dataStorage->getShortInfoList(version),
+                                                            context->hasFeature(FEATURE_COMPACT_ENCODING));
+        encoded = encodeResponse(response, context);
+        cache.store(LISTING_KEY, version, variant, encoded);
+    }
+
+    if (request->isConditional())
+        Packet::constructResourceVersion(version, true).writeToStreamSocket(sk);
+    sk->send(encoded->data(), encoded->size());
 }
 
 
@@ -25,8 +80,36 @@ static void lotDetailsRequestHandler(stream_socket *sk, Packet *packet, TradeCon
 
     LotDetailsRequest *request = (LotDetailsRequest *) packet->getBody();
     uint32_t lotId = request->getLotId();
-    LotFullInfo lotFullInfo = context->getDataStorage()->getLotInfoById(lotId);
-    Packet::constructLotDetailsResponse(lotFullInfo).writeToStreamSocket(sk);
+    DataStorage *dataStorage = context->getDataStorage();
+    ResponseCache &cache = dataStorage->getResponseCache();
+    unsigned variant = responseVariant(context);
+
+    uint64_t version;
+    ResponseCache::Buffer encoded;
+    if (dataStorage->getLotVersion(lotId, version)) {
+        if (request->isConditional() && request->getKnownVersion() == version) {
+            Packet::constructResourceVersion(version, false).writeToStreamSocket(sk);
+            return;
+        }
+        encoded = cache.find(lotId, version, variant);
+    }
+
+    if (!encoded) {
+        LotFullInfo lotFullInfo;
+        if (!dataStorage->getLotInfoById(lotId, lotFullInfo, version)) {
+            Packet::constructRejected(Rejected::UNKNOWN_LOT).writeToStreamSocket(sk);
+            return;
+        }
+
+        Packet response = Packet::constructLotDetailsResponse(lotFullInfo,
+                                                              context->hasFeature(FEATURE_COMPACT_ENCODING));
+        encoded = encodeResponse(response, context);
+        cache.store(lotId, version, variant, encoded);
+    }
+
+    if (request->isConditional())
+        Packet::constructResourceVersion(version, true).writeToStreamSocket(sk);
+    sk->send(encoded->data(), encoded->size());
 }
 
 
@@ -48,25 +131,202 @@ static void closeLotRequestHandler(stream_socket *sk, Packet *packet, TradeConne
 }
 
 
+static void queryLotsRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
+    std::cerr << context->getUid() << ":" << "query lots request handler\n";
+
+    QueryLotsRequest *request = (QueryLotsRequest *) packet->getBody();
+    DataStorage *dataStorage = context->getDataStorage();
+    std::list<LotShortInfo> lots;
+
+    switch (request->getQuery()) {
+        case QueryLotsRequest::OPEN_LOTS:
+            lots = dataStorage->getOpenLots();
+            break;
+        case QueryLotsRequest::LOTS_BY_OWNER:
+            lots = dataStorage->getLotsByOwner(request->getOwnerId());
+            break;
+        case QueryLotsRequest::LOTS_BY_BEST_PRICE:
+            lots = dataStorage->getLotsByBestPrice(request->getMinPrice(), request->getMaxPrice());
+            break;
+    }
+
+    Packet response = Packet::constructListLotsResponse(lots, context->hasFeature(FEATURE_COMPACT_ENCODING));
+    writeLargeResponse(response, sk, context);
+}
+
+
+static void searchRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
+    std::cerr << context->getUid() << ":" << "search request handler\n";
+
+    SearchRequest *request = (SearchRequest *) packet->getBody();
+    Packet response = Packet::constructListLotsResponse(
+            context->getDataStorage()->searchLots(request->getQuery(), request->getLimit()),
+            context->hasFeature(FEATURE_COMPACT_ENCODING));
+    writeLargeResponse(response, sk, context);
+}
+
+
+static void aggregateRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
+    std::cerr << context->getUid() << ":" << "aggregate request handler\n";
+
+    AggregateRequest *request = (AggregateRequest *) packet->getBody();
+    uint32_t firstLotId = request->getFirstLotId();
+    uint32_t lastLotId = request->getLastLotId();
+    if (request->isPerLot() && firstLotId <= lastLotId && lastLotId - firstLotId >= MAX_AGGREGATE_LOTS) {
+        Packet::constructRejected(Rejected::TOO_LARGE).writeToStreamSocket(sk);
+        return;
+    }
+
+    BetAggregate total;
+    std::vector<LotAggregate> lots;
+    if (!context->getDataStorage()->aggregateBets(firstLotId, lastLotId, total,
+                                                  request->isPerLot() ? &lots : nullptr)) {
+        Packet::constructRejected(Rejected::OVER_BUDGET).writeToStreamSocket(sk);
+        return;
+    }
+
+    Packet response = Packet::constructAggregateResponse(total, std::move(lots));
+    writeLargeResponse(response, sk, context);
+}
+
+
+static void featuresRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
+    std::cerr << context->getUid() << ":" << "features request handler\n";
+
+    FeaturesRequest *request = (FeaturesRequest *) packet->getBody();
+    uint32_t features = request->getFeatures() & SUPPORTED_FEATURES;
+    context->setFeatures(features);
+    Packet::constructFeaturesResponse(features).writeToStreamSocket(sk);
+}
+
+
+/*
+ * Streams the replication log to a follower until the server stops
+ * or the follower goes away, idle periods are filled with heartbeats.
+ */
+static void replicateRequestHandler(stream_socket *sk, Packet *packet, TradeConnection::Context *context) {
+    std::cerr << context->getUid() << ":" << "replicate request handler\n";
+
+    ReplicateRequest *request = (ReplicateRequest *) packet->getBody();
+    ReplicationLog *replicationLog = context->getDataStorage()->getReplicationLog();
+    uint64_t next = request->getFrom();
+    if (!replicationLog || next > replicationLog->size()) {
+        Packet::constructRejected(Rejected::REPLICATION_UNAVAILABLE).writeToStreamSocket(sk);
+        return;
+    }
+
+    std::list<Mutation> mutations;
+    while (replicationLog->read(next, REPLICATION_BATCH_LIMIT, REPLICATION_HEARTBEAT_MS, mutations)) {
+        size_t count = mutations.size();
+        Packet batch = Packet::constructReplicationBatch(next, std::move(mutations));
+        writeLargeResponse(batch, sk, context);
+        sk->flush();
+        next += count;
+        mutations.clear();
+    }
+}
+
+
+static bool isUpdateRequest(Body::BodyType type) {
+    return type == Body::BodyType::NEW_LOT_REQ || type == Body::BodyType::NEW_TIMED_LOT_REQ
+           || type == Body::BodyType::MAKE_BET_REQ || type == Body::BodyType::CLOSE_LOT_REQ;
+}
+
+
+static bool isReadRequest(Body::BodyType type) {
+    return type == Body::BodyType::LIST_LOTS_REQ || type == Body::BodyType::LOT_DET_REQ
+           || type == Body::BodyType::CONDITIONAL_LIST_LOTS_REQ || type == Body::BodyType::CONDITIONAL_LOT_DET_REQ
+           || type == Body::BodyType::AGGREGATE_REQ || type == Body::BodyType::QUERY_LOTS_REQ
+           || type == Body::BodyType::SEARCH_REQ;
+}
+
+
+static bool growsStorage(Body::BodyType type) {
+    return type == Body::BodyType::NEW_LOT_REQ || type == Body::BodyType::NEW_TIMED_LOT_REQ
+           || type == Body::BodyType::MAKE_BET_REQ;
+}
+
+
 static std::map<Body::BodyType, void (*)(stream_socket *, Packet *, TradeConnection::Context *)> messagesHandlers = {
         {Body::BodyType::NEW_LOT_REQ,   newLotRequestHandler},
         {Body::BodyType::LIST_LOTS_REQ, listLotsRequestHandler},
         {Body::BodyType::LOT_DET_REQ,   lotDetailsRequestHandler},
         {Body::BodyType::MAKE_BET_REQ,  makeBetRequestHandler},
         {Body::BodyType::CLOSE_LOT_REQ, closeLotRequestHandler},
+        {Body::BodyType::FEATURES_REQ,  featuresRequestHandler},
+        {Body::BodyType::QUERY_LOTS_REQ, queryLotsRequestHandler},
+        {Body::BodyType::SEARCH_REQ,    searchRequestHandler},
+        {Body::BodyType::NEW_TIMED_LOT_REQ, newLotRequestHandler},
+        {Body::BodyType::REPLICATE_REQ, replicateRequestHandler},
+        {Body::BodyType::CONDITIONAL_LIST_LOTS_REQ, listLotsRequestHandler},
+        {Body::BodyType::CONDITIONAL_LOT_DET_REQ,   lotDetailsRequestHandler},
+        {Body::BodyType::AGGREGATE_REQ, aggregateRequestHandler},
 };
 
 
 void TradeConnection::handle() {
-    Packet::constructAuthorisationResponse(context->getUid()).writeToStreamSocket(sk);
+    bool saidBye = false;
 
     try {
+        Packet::constructAuthorisationResponse(context->getUid()).writeToStreamSocket(&out);
+
         Packet packet;
+        DataStorage *dataStorage = context->getDataStorage();
         while (true) {
-            packet.readFromStreamSocket(sk);
-            if (packet.getBody()->getType() == Body::BodyType::BYE)
+            uint64_t receivedBefore = out.getReceivedSize();
+            packet.readFromStreamSocket(&out);
+            size_t requestSize = out.getReceivedSize() - receivedBefore;
+            if (capture)
+                record(packet);
+            Body::BodyType type = packet.getBody()->getType();
+            if (type == Body::BodyType::BYE) {
+                saidBye = true;
                 break;
-            messagesHandlers[packet.getBody()->getType()](sk, &packet, context);
+            }
+            auto handler = messagesHandlers.find(type);
+            if (handler == messagesHandlers.end()) {
+                /*
+                 * ответы и прочие сообщения, которые клиент слать не должен
+                 */
+                std::cerr << context->getUid() << ":" << "unexpected message type " << type << '\n';
+                Packet::constructRejected(Rejected::NOT_A_REQUEST).writeToStreamSocket(&out);
+                continue;
+            }
+            if (!context->getRateLimiter().admit(type)) {
+                std::cerr << context->getUid() << ":" << "request rejected by rate limit\n";
+                Packet::constructRejected(Rejected::RATE_LIMITED).writeToStreamSocket(&out);
+                continue;
+            }
+            if (!memoryBudget->tryCharge(MemoryLimits::REQUESTS, requestSize)) {
+                Packet::constructRejected(Rejected::OVER_BUDGET).writeToStreamSocket(&out);
+                continue;
+            }
+            MemoryBudget::Charge requestCharge(memoryBudget, MemoryLimits::REQUESTS, requestSize);
+            if (dataStorage->isReadOnly() && isUpdateRequest(type)) {
+                Packet::constructRejected(Rejected::READ_ONLY).writeToStreamSocket(&out);
+                continue;
+            }
+            if (isReadRequest(type) && dataStorage->isStale()) {
+                Packet::constructRejected(Rejected::STALE).writeToStreamSocket(&out);
+                continue;
+            }
+            if (growsStorage(type) && !dataStorage->hasRoom()) {
+                Packet::constructRejected(Rejected::OVER_BUDGET).writeToStreamSocket(&out);
+                continue;
+            }
+            handler->second(&out, &packet, context);
+        }
+    } catch (message_too_large &e) {
+        /*
+         * остаток сообщения не отличить от следующего,
+         * поэтому отказываем и заканчиваем соединение
+         */
+        std::cerr << context->getUid() << ":" << e.what() << '\n';
+        try {
+            Packet::constructRejected(Rejected::TOO_LARGE).writeToStreamSocket(&out);
+            out.flush();
+        } catch (std::exception &e) {
+            std::cerr << context->getUid() << ":" << e.what() << '\n';
         }
     } catch (std::exception &e) {
         /*
@@ -76,21 +336,50 @@ void TradeConnection::handle() {
          */
         std::cerr << context->getUid() << ":" << e.what() << '\n';
     }
+    if (capture && !saidBye)
+        capture->write_end(context->getUid());
     std::cerr << context->getUid() << ":" << "connection closed\n";
 }
 
 
+void TradeConnection::record(Packet &packet) {
+    buffer_stream encoded;
+    packet.writeToStreamSocket(&encoded);
+    capture->write(context->getUid(), encoded.get_data());
+}
+
+
 /*
  * TradeServer implementation:
  */
 
-void TradeServer::listenConnection() {
+void TradeServer::listenConnection(stream_server_socket *serverSocket) {
     try {
         std::cerr << "start listen connections\n";
 
         while (true) {
             stream_socket *streamSocket = serverSocket->accept_one_client();
-            connections.push_back(new TradeConnection(streamSocket, &dataStorage));
+
+            /*
+             * место занимаем сразу, слушающих потоков несколько,
+             * и проверка с последующим увеличением пропустила бы лишние сессии
+             */
+            if (activeSessions.fetch_add(1) >= config.maxSessions
+                || !memoryBudget.hasRoom(MemoryLimits::CONNECTIONS, TradeConnection::SESSION_MEMORY)) {
+                --activeSessions;
+                std::cerr << "sessions limit or memory budget is reached, connection refused\n";
+                try {
+                    Packet::constructBye().writeToStreamSocket(streamSocket);
+                } catch (std::exception &e) {
+                    std::cerr << e.what() << '\n';
+                }
+                serverSocket->release_client(streamSocket);
+                continue;
+            }
+
+            TradeConnection *connection = new TradeConnection(streamSocket, &dataStorage, config.sendQueue,
+                                                             config.rateLimits, &memoryBudget, capture);
+            workerPool.submit([this, connection, serverSocket] { serveConnection(connection, serverSocket); });
         }
     } catch (std::exception &e) {
         /*
@@ -102,96 +391,581 @@ void TradeServer::listenConnection() {
 }
 
 
+void TradeServer::serveConnection(TradeConnection *connection, stream_server_socket *serverSocket) {
+    connection->handle();
+
+    /*
+     * сессия закончилась, сразу освобождаем соединение и его сокет,
+     * чтобы они не копились до завершения сервера
+     */
+    stream_socket *streamSocket = connection->getSocket();
+    delete connection;
+    serverSocket->release_client(streamSocket);
+    --activeSessions;
+}
+
+
+static stream_server_socket *createTcpServerSocket(const ServerConfig &config) {
+    bool reusePort = config.acceptors > 1;
+
+    if (config.uring) {
+        try {
+            return new uring_server_socket(config.ip, config.port, config.backlog, reusePort);
+        } catch (std::exception &e) {
+            /*
+             * ядро не поддерживает нужные возможности io_uring
+             * или они запрещены, работаем на обычных сокетах
+             */
+            std::cerr << e.what() << ", falling back to blocking sockets\n";
+        }
+    }
+
+    return new tcp_server_socket(config.ip, config.port, config.backlog, reusePort);
+}
+
+
+TradeServer::TradeServer(const ServerConfig &config)
+        : config(config), workerPool(config.workers), activeSessions(0),
+          dataStorage(config.urgentPerBulk, config.hugePages, config.strictBets, config.shard, config.shards),
+          memoryBudget(config.memoryLimits), socketBuffers(&memoryBudget) {
+    dataStorage.setMemoryBudget(&memoryBudget);
+    get_decode_limits() = config.decodeLimits;
+
+    if (config.capturePath)
+        capture = new capture_writer(config.capturePath);
+
+    for (size_t i = 0; i < config.acceptors; ++i)
+        serverSockets.push_back(createTcpServerSocket(config));
+
+    if (config.unixPath)
+        serverSockets.push_back(new unix_server_socket(config.unixPath, config.backlog));
+
+    if (config.shmPath)
+        serverSockets.push_back(new shm_server_socket(config.shmPath, config.shmBusyPoll, config.backlog));
+
+    for (auto i = serverSockets.begin(); i != serverSockets.end(); ++i)
+        (*i)->set_buffer_accounting(&socketBuffers);
+
+    if (config.engine) {
+        engine = new OrderEngine(&dataStorage, config.engineQueue);
+        dataStorage.setEngine(engine);
+    }
+
+    if (config.replicationLog || config.followAddr) {
+        replicationLog = new ReplicationLog();
+        dataStorage.setReplicationLog(replicationLog);
+    }
+
+    if (config.followAddr) {
+        follower = new Follower(&dataStorage, config.followAddr, config.followPort, config.maxStalenessMs);
+        dataStorage.setFollower(follower);
+    }
+}
+
+
+void TradeServer::closeExpiredLots() {
+    std::unique_lock<std::mutex> lock(expiryMtx);
+
+    while (!stopping) {
+        /*
+         * лоты со сроком бывают не всегда, пустое колесо не трогаем,
+         * чтобы не брать блокировку хранилища зря
+         */
+        if (dataStorage.hasDeadlines()) {
+            lock.unlock();
+            uint32_t closed = dataStorage.closeExpiredLots();
+            if (closed > 0)
+                std::cerr << "closed " << closed << " expired lots\n";
+            lock.lock();
+        }
+
+        expiryStop.wait_for(lock, std::chrono::milliseconds(DataStorage::DEADLINE_TICK_MS));
+    }
+}
+
+
 void TradeServer::start() {
     std::cerr << "trade server starts\n";
-    listenerThread = std::thread(listenConnectionWrapper, this);
+    expiryThread = std::thread(&TradeServer::closeExpiredLots, this);
+    for (auto i = serverSockets.begin(); i != serverSockets.end(); ++i)
+        listenerThreads.push_back(std::thread(listenConnectionWrapper, this, *i));
 }
 
 
 TradeServer::~TradeServer() {
     std::cerr << "server closes\n";
-    serverSocket->close();
-    listenerThread.join();
-    for (auto i = connections.begin(); i != connections.end(); ++i) {
-        delete *i;
+    for (auto i = serverSockets.begin(); i != serverSockets.end(); ++i)
+        (*i)->close();
+    for (auto i = listenerThreads.begin(); i != listenerThreads.end(); ++i)
+        i->join();
+    if (replicationLog)
+        replicationLog->close();
+    workerPool.stop();
+    if (expiryThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(expiryMtx);
+            stopping = true;
+            expiryStop.notify_one();
+        }
+        expiryThread.join();
+    }
+    if (follower) {
+        follower->stop();
+        dataStorage.setFollower(nullptr);
+        delete follower;
     }
+    if (engine) {
+        engine->stop();
+        dataStorage.setEngine(nullptr);
+        delete engine;
+    }
+    if (replicationLog) {
+        dataStorage.setReplicationLog(nullptr);
+        delete replicationLog;
+    }
+    delete capture;
+    for (auto i = serverSockets.begin(); i != serverSockets.end(); ++i)
+        delete *i;
+}
+
+
+/*
+ * DataStorage implementation:
+ */
+
+static LockSite addNewUserSite("addNewUser");
+static LockSite removeUserSite("removeUser");
+static LockSite getLotInfoByIdSite("getLotInfoById");
+static LockSite addNewLotSite("addNewLot");
+static LockSite getShortInfoListSite("getShortInfoList");
+static LockSite makeBetSite("makeBet");
+static LockSite closeLotSite("closeLot");
+static LockSite getOpenLotsSite("getOpenLots");
+static LockSite getLotsByOwnerSite("getLotsByOwner");
+static LockSite getLotsByBestPriceSite("getLotsByBestPrice");
+static LockSite searchLotsSite("searchLots");
+static LockSite closeExpiredLotsSite("closeExpiredLots");
+static LockSite replicateSite("replicate");
+
+const unsigned DataStorage::DEADLINE_TICK_MS;
+
+
+uint64_t DataStorage::currentTick() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count() / DEADLINE_TICK_MS;
 }
 
 
 uint32_t DataStorage::addNewUser() {
-    std::unique_lock<std::mutex> lock(mtx);
+    ProfiledLock lock(mtx, addNewUserSite);
 
-    uint32_t uid;
-    connectedUsersIds.emplace(uid = freeUid++);
+    uint32_t uid = freeUid++ * lotsData.getShards() + lotsData.getShard();
+    connectedUsersIds.emplace(uid);
 
     return uid;
 }
 
 
-LotFullInfo DataStorage::getLotInfoById(uint32_t lotId) {
-    std::unique_lock<std::mutex> lock(mtx);
-    return lotsData[lotId];
+void DataStorage::removeUser(uint32_t uid) {
+    ProfiledLock lock(mtx, removeUserSite);
+    connectedUsersIds.erase(uid);
 }
 
 
-uint32_t DataStorage::addNewLot(uint32_t startPrice, uint32_t ownerId, std::string description) {
-    std::unique_lock<std::mutex> lock(mtx);
+bool DataStorage::getLotInfoById(uint32_t lotId, LotFullInfo &lotInfo) {
+    uint64_t version;
+    return getLotInfoById(lotId, lotInfo, version);
+}
+
 
-    uint32_t newLotId = lotsData.size() + 1;
-    lotsData[newLotId] = LotFullInfo(newLotId, ownerId, true, description, startPrice, std::list<Bet>());
+bool DataStorage::getLotInfoById(uint32_t lotId, LotFullInfo &lotInfo, uint64_t &version) {
+    ProfiledLock lock(mtx, getLotInfoByIdSite, PriorityMutex::BULK);
+
+    LotFullInfo *found = lotsData.find(lotId);
+    if (!found)
+        return false;
+
+    lotInfo = *found;
+    version = lotsData.getVersion(lotId).load(std::memory_order_relaxed);
+    return true;
+}
+
+
+bool DataStorage::getLotVersion(uint32_t lotId, uint64_t &version) {
+    if (!lotsData.find(lotId))
+        return false;
+
+    version = lotsData.getVersion(lotId).load(std::memory_order_acquire);
+    return true;
+}
+
+
+void DataStorage::touchLot(uint32_t lotId, bool listed) {
+    lotsData.getVersion(lotId).fetch_add(1, std::memory_order_release);
+    if (listed)
+        listingVersion.fetch_add(1, std::memory_order_release);
+}
+
+
+uint32_t DataStorage::addNewLot(uint32_t startPrice, uint32_t ownerId, std::string description, uint32_t duration,
+                               uint32_t extension) {
+    if (engine)
+        return engine->addNewLot(startPrice, ownerId, std::move(description), duration, extension);
+
+    ProfiledLock lock(mtx, addNewLotSite);
+    return applyAddNewLot(startPrice, ownerId, description, duration, extension);
+}
+
+
+uint32_t DataStorage::applyAddNewLot(uint32_t startPrice, uint32_t ownerId, const std::string &description,
+                                     uint32_t duration, uint32_t extension) {
+    LotFullInfo lotInfo(0, ownerId, true, std::string(), startPrice, std::list<Bet>());
+    lotInfo.descriptionRef = descriptions.intern(description);
+    uint32_t newLotId = lotsData.append(lotInfo);
+    chargeStorage(LOT_MEMORY + description.size());
+    logMutation(Mutation::NEW_LOT, newLotId, ownerId, startPrice, 0, lotInfo.descriptionRef);
+    listingVersion.fetch_add(1, std::memory_order_release);
+    openLots.insert(newLotId);
+    lotsByOwner[ownerId].insert(newLotId);
+    lotsByBestPrice.insert(std::make_pair(0u, newLotId));
+    descriptionIndex.add(newLotId, description);
+
+    if (duration > 0) {
+        const uint64_t ticksPerSecond = 1000 / DEADLINE_TICK_MS;
+        LotDeadline &deadline = lotsData.getDeadline(newLotId);
+        deadline.timer.id = newLotId;
+        deadline.extension = extension * ticksPerSecond;
+        /*
+         * пока сроков не было, колесо не двигали, догоняем его разом
+         */
+        if (deadlines.size() == 0)
+            deadlines.advance(currentTick(), expiredLots);
+        deadlines.schedule(&deadline.timer, currentTick() + duration * ticksPerSecond);
+        scheduledDeadlines.store(deadlines.size(), std::memory_order_relaxed);
+    }
 
     return newLotId;
 }
 
 
 std::list<LotShortInfo> DataStorage::getShortInfoList() {
-    std::unique_lock<std::mutex> lock(mtx);
+    uint64_t version;
+    return getShortInfoList(version);
+}
+
+
+std::list<LotShortInfo> DataStorage::getShortInfoList(uint64_t &version) {
+    ProfiledLock lock(mtx, getShortInfoListSite, PriorityMutex::BULK);
     std::list<LotShortInfo> shortInfoList;
 
-    for (auto i = lotsData.begin(); i != lotsData.end(); ++i) {
-        LotFullInfo &lotInfo = i->second;
-        shortInfoList.push_back(LotShortInfo(lotInfo.lotId, lotInfo.opened, lotInfo.startPrice, lotInfo.getBestPrice(),
-                                             lotInfo.description));
+    version = listingVersion.load(std::memory_order_relaxed);
+
+    for (uint32_t slot = 0, count = lotsData.size(); slot < count; ++slot) {
+        LotFullInfo &lotInfo = lotsData.get(lotsData.idAt(slot));
+        shortInfoList.push_back(getShortInfo(lotInfo, lotInfo.getBestPrice()));
     }
 
     return shortInfoList;
 }
 
 
-bool DataStorage::makeBet(uint32_t uid, const Bet &bet) try {
-    std::unique_lock<std::mutex> lock(mtx);
+LotShortInfo DataStorage::getShortInfo(const LotFullInfo &lotInfo, uint32_t bestPrice) {
+    return LotShortInfo(lotInfo.lotId, lotInfo.opened, lotInfo.startPrice, bestPrice, lotInfo.getDescription());
+}
+
+
+std::list<LotShortInfo> DataStorage::getOpenLots() {
+    ProfiledLock lock(mtx, getOpenLotsSite, PriorityMutex::BULK);
+    std::list<LotShortInfo> shortInfoList;
+
+    for (auto i = openLots.begin(); i != openLots.end(); ++i) {
+        LotFullInfo &lotInfo = lotsData.get(*i);
+        shortInfoList.push_back(getShortInfo(lotInfo, lotInfo.getBestPrice()));
+    }
+
+    return shortInfoList;
+}
+
+
+std::list<LotShortInfo> DataStorage::getLotsByOwner(uint32_t ownerId) {
+    ProfiledLock lock(mtx, getLotsByOwnerSite, PriorityMutex::BULK);
+    std::list<LotShortInfo> shortInfoList;
+
+    auto owned = lotsByOwner.find(ownerId);
+    if (owned == lotsByOwner.end())
+        return shortInfoList;
+
+    for (auto i = owned->second.begin(); i != owned->second.end(); ++i) {
+        LotFullInfo &lotInfo = lotsData.get(*i);
+        shortInfoList.push_back(getShortInfo(lotInfo, lotInfo.getBestPrice()));
+    }
+
+    return shortInfoList;
+}
+
+
+std::list<LotShortInfo> DataStorage::getLotsByBestPrice(uint32_t minPrice, uint32_t maxPrice) {
+    ProfiledLock lock(mtx, getLotsByBestPriceSite, PriorityMutex::BULK);
+    std::list<LotShortInfo> shortInfoList;
+
+    auto end = lotsByBestPrice.upper_bound(std::make_pair(maxPrice, UINT32_MAX));
+    for (auto i = lotsByBestPrice.lower_bound(std::make_pair(minPrice, 0u)); i != end; ++i)
+        shortInfoList.push_back(getShortInfo(lotsData.get(i->second), i->first));
+
+    return shortInfoList;
+}
+
+
+std::list<LotShortInfo> DataStorage::searchLots(const std::string &query, uint32_t limit) {
+    ProfiledLock lock(mtx, searchLotsSite, PriorityMutex::BULK);
+    std::list<LotShortInfo> shortInfoList;
+
+    std::vector<uint32_t> found = descriptionIndex.search(query, limit);
+    for (auto i = found.begin(); i != found.end(); ++i) {
+        LotFullInfo &lotInfo = lotsData.get(*i);
+        shortInfoList.push_back(getShortInfo(lotInfo, lotInfo.getBestPrice()));
+    }
+
+    return shortInfoList;
+}
+
+
+bool DataStorage::makeBet(uint32_t uid, const Bet &bet) {
+    if (strictBets && !raiseBestBet(uid, bet))
+        return false;
+
+    if (engine)
+        return engine->makeBet(uid, bet);
+
+    ProfiledLock lock(mtx, makeBetSite);
+    return applyMakeBet(uid, bet);
+}
+
+
+bool DataStorage::applyMakeBet(uint32_t uid, const Bet &bet) {
     uint32_t lotId = bet.productId;
 
-    if (lotsData.at(lotId).ownerId != uid
-        && lotsData.at(lotId).opened
-        && lotsData.at(lotId).startPrice <= bet.newPrice) {
-        lotsData[lotId].bets.push_back(bet);
+    if (strictBets) {
+        /*
+         * ставка уже победила в raiseBestBet, осталось её записать,
+         * если только лот не закрыли между CAS и блокировкой: тогда ставку
+         * не записываем, а слово лучшей ставки возвращаем к лучшей записанной
+         */
+        LotFullInfo &lotInfo = lotsData.get(lotId);
+        if (!lotInfo.opened) {
+            uint64_t recorded = lotInfo.bets.empty()
+                                ? 0 : BestBet::pack(lotInfo.bets.back().newPrice, lotInfo.bets.back().customerId);
+            lotsData.getBestBet(lotId).store(recorded | BestBet::CLOSED, std::memory_order_release);
+            return false;
+        }
+        recordBet(lotInfo, bet);
+        return true;
+    }
+
+    LotFullInfo *lotInfo = lotsData.find(lotId);
+
+    if (lotInfo
+        && lotInfo->ownerId != uid
+        && lotInfo->opened
+        && lotInfo->startPrice <= bet.newPrice) {
+        uint32_t bestPrice = lotInfo->getBestPrice();
+        if (bet.newPrice > bestPrice) {
+            lotsByBestPrice.erase(std::make_pair(bestPrice, lotId));
+            lotsByBestPrice.insert(std::make_pair(bet.newPrice, lotId));
+            lotsData.getBestBet(lotId).store(BestBet::pack(bet.newPrice, uid), std::memory_order_release);
+        }
+        addBetRow(lotId, bet.customerId, bet.newPrice);
+        lotInfo->bets.push_back(bet);
+        logMutation(Mutation::BET, lotId, bet.customerId, bet.newPrice);
+        touchLot(lotId, bet.newPrice > bestPrice);
+        extendDeadline(lotId);
         return true;
     }
 
     return false;
-} catch (...) {
+}
+
+
+bool DataStorage::raiseBestBet(uint32_t uid, const Bet &bet) {
     /*
-     * здесь окажемся если id был некорректным,
-     * тогда мы не можем сделать ставку
+     * владелец и стартовая цена не меняются после создания лота,
+     * их можно читать без блокировки
      */
-    return false;
+    LotFullInfo *lotInfo = lotsData.find(bet.productId);
+    if (!lotInfo || lotInfo->ownerId == uid || lotInfo->startPrice > bet.newPrice)
+        return false;
+
+    std::atomic<uint64_t> &bestBet = lotsData.getBestBet(bet.productId);
+    uint64_t current = bestBet.load(std::memory_order_acquire);
+    uint64_t raised = BestBet::pack(bet.newPrice, uid);
+
+    do {
+        if (BestBet::isClosed(current) || bet.newPrice <= BestBet::getPrice(current))
+            return false;
+    } while (!bestBet.compare_exchange_weak(current, raised, std::memory_order_acq_rel, std::memory_order_acquire));
+
+    return true;
 }
 
 
-bool DataStorage::closeLot(int uid, int lotId) try {
-    std::unique_lock<std::mutex> lock(mtx);
+void DataStorage::recordBet(LotFullInfo &lotInfo, const Bet &bet) {
+    uint32_t oldBestPrice = lotInfo.bets.empty() ? 0 : lotInfo.bets.back().newPrice;
 
-    if (lotsData.at(lotId).ownerId == uid) {
-        lotsData[lotId].opened = false;
+    /*
+     * победители записываются не обязательно в порядке своих CAS,
+     * поэтому вставляем с конца по цене
+     */
+    auto position = lotInfo.bets.end();
+    uint32_t fromEnd = 0;
+    while (position != lotInfo.bets.begin() && std::prev(position)->newPrice > bet.newPrice) {
+        --position;
+        ++fromEnd;
+    }
+    addBetRow(lotInfo.lotId, bet.customerId, bet.newPrice);
+    lotInfo.bets.insert(position, bet);
+    logMutation(Mutation::BET, lotInfo.lotId, bet.customerId, bet.newPrice, fromEnd);
+
+    uint32_t newBestPrice = lotInfo.bets.back().newPrice;
+    if (newBestPrice != oldBestPrice) {
+        lotsByBestPrice.erase(std::make_pair(oldBestPrice, lotInfo.lotId));
+        lotsByBestPrice.insert(std::make_pair(newBestPrice, lotInfo.lotId));
+    }
+    touchLot(lotInfo.lotId, newBestPrice != oldBestPrice);
+    extendDeadline(lotInfo.lotId);
+}
+
+
+void DataStorage::extendDeadline(uint32_t lotId) {
+    LotDeadline &deadline = lotsData.getDeadline(lotId);
+    if (!deadline.timer.isScheduled() || deadline.extension == 0)
+        return;
+
+    uint64_t extended = currentTick() + deadline.extension;
+    if (deadline.timer.expiry < extended)
+        deadlines.schedule(&deadline.timer, extended);
+}
+
+
+bool DataStorage::closeLot(int uid, int lotId) {
+    if (engine)
+        return engine->closeLot(uid, lotId);
+
+    ProfiledLock lock(mtx, closeLotSite);
+    return applyCloseLot(uid, lotId);
+}
+
+
+bool DataStorage::applyCloseLot(uint32_t uid, uint32_t lotId) {
+    LotFullInfo *lotInfo = lotsData.find(lotId);
+
+    if (lotInfo && lotInfo->ownerId == uid) {
+        markClosed(*lotInfo);
         return true;
     }
 
     return false;
-} catch (...) {
+}
+
+
+void DataStorage::markClosed(LotFullInfo &lotInfo) {
+    if (lotInfo.opened) {
+        logMutation(Mutation::CLOSE, lotInfo.lotId);
+        touchLot(lotInfo.lotId, true);
+    }
+
+    lotInfo.opened = false;
+    openLots.erase(lotInfo.lotId);
+    lotsData.getBestBet(lotInfo.lotId).fetch_or(BestBet::CLOSED, std::memory_order_acq_rel);
+    deadlines.cancel(&lotsData.getDeadline(lotInfo.lotId).timer);
+    scheduledDeadlines.store(deadlines.size(), std::memory_order_relaxed);
+}
+
+
+uint32_t DataStorage::closeExpiredLots() {
+    if (engine)
+        return engine->closeExpiredLots();
+
+    ProfiledLock lock(mtx, closeExpiredLotsSite);
+    return applyCloseExpiredLots();
+}
+
+
+uint32_t DataStorage::applyCloseExpiredLots() {
+    expiredLots.clear();
+    deadlines.advance(currentTick(), expiredLots);
+    scheduledDeadlines.store(deadlines.size(), std::memory_order_relaxed);
+
+    for (auto i = expiredLots.begin(); i != expiredLots.end(); ++i)
+        markClosed(lotsData.get(*i));
+
+    return (uint32_t) expiredLots.size();
+}
+
+
+void DataStorage::logMutation(uint32_t type, uint32_t lotId, uint32_t uid, uint32_t price, uint32_t fromEnd,
+                              TextRef description) {
+    if (!replicationLog)
+        return;
+
+    Mutation mutation;
+    mutation.type = type;
+    mutation.lotId = lotId;
+    mutation.uid = uid;
+    mutation.price = price;
+    mutation.fromEnd = fromEnd;
+    mutation.descriptionRef = description;
+    replicationLog->append(mutation);
+    chargeStorage(sizeof(Mutation));
+}
+
+
+void DataStorage::replicate(const std::list<Mutation> &mutations) {
+    ProfiledLock lock(mtx, replicateSite);
+
+    for (auto i = mutations.begin(); i != mutations.end(); ++i)
+        applyReplicated(*i);
+}
+
+
+void DataStorage::applyReplicated(const Mutation &mutation) {
+    if (mutation.type == Mutation::NEW_LOT) {
+        TextRef description = mutation.getDescription();
+        uint32_t lotId = applyAddNewLot(mutation.price, mutation.uid, std::string(description.data, description.size),
+                                        0, 0);
+        if (lotId != mutation.lotId)
+            throw std::runtime_error("replicated lot id doesn't match the local one");
+        return;
+    }
+
+    LotFullInfo *lotInfo = lotsData.find(mutation.lotId);
+    if (!lotInfo)
+        throw std::runtime_error("replicated mutation of an unknown lot");
+
+    if (mutation.type == Mutation::CLOSE) {
+        markClosed(*lotInfo);
+        return;
+    }
+
     /*
-     * здесь окажемся если id был некорректным,
-     * тогда мы не можем закрыть лот
+     * ставка встаёт туда же, куда её поставил основной сервер,
+     * а индекс цены ведём по слову лучшей ставки: на фолловере
+     * его меняет только репликация
      */
-    return false;
+    auto position = lotInfo->bets.end();
+    for (uint32_t i = 0; i < mutation.fromEnd && position != lotInfo->bets.begin(); ++i)
+        --position;
+    addBetRow(mutation.lotId, mutation.uid, mutation.price);
+    lotInfo->bets.insert(position, Bet(mutation.lotId, mutation.uid, mutation.price));
+
+    std::atomic<uint64_t> &bestBet = lotsData.getBestBet(mutation.lotId);
+    uint64_t current = bestBet.load(std::memory_order_relaxed);
+    touchLot(mutation.lotId, mutation.price > BestBet::getPrice(current));
+    if (mutation.price > BestBet::getPrice(current)) {
+        lotsByBestPrice.erase(std::make_pair(BestBet::getPrice(current), mutation.lotId));
+        lotsByBestPrice.insert(std::make_pair(mutation.price, mutation.lotId));
+        bestBet.store(BestBet::pack(mutation.price, mutation.uid) | (current & BestBet::CLOSED),
+                      std::memory_order_release);
+    }
+
+    logMutation(Mutation::BET, mutation.lotId, mutation.uid, mutation.price, mutation.fromEnd);
 }
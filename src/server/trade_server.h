@@ -2,62 +2,330 @@
 
 #include <thread>
 #include <set>
+#include <vector>
 #include "../protocol.h"
+#include "../capture_file.h"
 #include "../tcp_socket.h"
+#include "../uring_socket.h"
+#include "../unix_socket.h"
+#include "../shm_socket.h"
+#include "lock_profiler.h"
+#include "worker_pool.h"
+#include "outbound_queue.h"
+#include "rate_limiter.h"
+#include "text_index.h"
+#include "lot_table.h"
+#include "string_arena.h"
+#include "order_engine.h"
+#include "replication_log.h"
+#include "follower.h"
+#include "response_cache.h"
+#include "memory_budget.h"
+#include "bet_columns.h"
+#include <atomic>
 #include <iostream>
 
 #define DEFAULT_ADDR "127.0.0.1"
 #define DEFAULT_PORT 40001
+#define DEFAULT_WORKERS 64
 
 
+/*
+ * Bets, closes and other short updates take the lock as urgent,
+ * listings and details copying lots out take it as bulk, so under
+ * overload updates are served first and reads get one turn
+ * in every urgentPerBulk + 1.
+ */
 class DataStorage {
     uint32_t freeUid = 0;
-    std::mutex mtx;
+    ProfiledMutex mtx;
     std::set<uint32_t> connectedUsersIds;
-    std::map<uint32_t, LotFullInfo> lotsData;
+    LotTable lotsData;
+    /*
+     * Secondary indexes over lotsData, updated under the same lock
+     * by every operation changing the indexed fields.
+     * lotsByBestPrice holds (best price, lot id), 0 for lots without bets.
+     */
+    std::set<uint32_t> openLots;
+    std::map<uint32_t, std::set<uint32_t>> lotsByOwner;
+    std::set<std::pair<uint32_t, uint32_t>> lotsByBestPrice;
+    TextIndex descriptionIndex;
+    /*
+     * Lots keep only references to their descriptions,
+     * equal descriptions share one copy.
+     */
+    StringInterner descriptions;
+    /*
+     * With an engine set updates are applied by its thread only.
+     */
+    OrderEngine *engine = nullptr;
+    /*
+     * Strict bets must beat the current best one. The best bet of every lot
+     * is raised by CAS without the lock, so losing bets are rejected
+     * right away and only winners are recorded under the lock.
+     * Bet histories are then ordered by price.
+     */
+    bool strictBets;
+    /*
+     * Deadlines of timed lots in ticks of DEADLINE_TICK_MS, the number
+     * of scheduled ones is mirrored to be read without the lock.
+     */
+    TimerWheel deadlines;
+    std::atomic<size_t> scheduledDeadlines;
+    std::vector<uint32_t> expiredLots;
+    /*
+     * With a log every mutation is recorded for followers,
+     * with a follower set the storage changes only by replication.
+     */
+    ReplicationLog *replicationLog = nullptr;
+    Follower *follower = nullptr;
+    /*
+     * Version of the full listing, bumped with lot versions
+     * when a change shows in the listing.
+     */
+    std::atomic<uint64_t> listingVersion;
+    ResponseCache responseCache;
+    /*
+     * Columnar copy of all the bets for aggregate queries,
+     * appended with every bet under the lock.
+     */
+    BetColumns betColumns;
+    /*
+     * Lots, bets and logged mutations are charged to the STORAGE
+     * category, it only grows.
+     */
+    MemoryBudget *memoryBudget = nullptr;
+
+    void chargeStorage(size_t bytes) {
+        if (memoryBudget)
+            memoryBudget->charge(MemoryLimits::STORAGE, bytes);
+    }
+
+    void addBetRow(uint32_t lotId, uint32_t customerId, uint32_t price) {
+        betColumns.append(lotId, customerId, price);
+        chargeStorage(BET_MEMORY);
+    }
+
+    static uint64_t currentTick();
+
+    void touchLot(uint32_t lotId, bool listed);
+
+    LotShortInfo getShortInfo(const LotFullInfo &lotInfo, uint32_t bestPrice);
+
+    /*
+     * Updates themselves, the caller holds the lock.
+     */
+    uint32_t applyAddNewLot(uint32_t startPrice, uint32_t ownerId, const std::string &description,
+                            uint32_t duration, uint32_t extension);
+
+    bool applyMakeBet(uint32_t uid, const Bet &bet);
+
+    bool raiseBestBet(uint32_t uid, const Bet &bet);
+
+    void recordBet(LotFullInfo &lotInfo, const Bet &bet);
+
+    bool applyCloseLot(uint32_t uid, uint32_t lotId);
+
+    uint32_t applyCloseExpiredLots();
+
+    void markClosed(LotFullInfo &lotInfo);
+
+    void extendDeadline(uint32_t lotId);
+
+    void logMutation(uint32_t type, uint32_t lotId, uint32_t uid = 0, uint32_t price = 0, uint32_t fromEnd = 0,
+                     TextRef description = TextRef());
+
+    void applyReplicated(const Mutation &mutation);
+
+    friend class OrderEngine;
 
 public:
+    /*
+     * A storage may be shard number shard of shards storages of one auction:
+     * it only has lots and users whose ids give shard modulo shards.
+     */
+    explicit DataStorage(unsigned urgentPerBulk = PriorityMutex::DEFAULT_URGENT_PER_BULK, bool hugePages = false,
+                         bool strictBets = false, uint32_t shard = 0, uint32_t shards = 1)
+            : lotsData(shard, shards), descriptions(hugePages), strictBets(strictBets), deadlines(currentTick()),
+              scheduledDeadlines(0), listingVersion(1) {
+        mtx.setUrgentPerBulk(urgentPerBulk);
+    }
+
+    void setEngine(OrderEngine *engine) {
+        this->engine = engine;
+    }
+
+    void setReplicationLog(ReplicationLog *replicationLog) {
+        this->replicationLog = replicationLog;
+    }
+
+    ReplicationLog *getReplicationLog() {
+        return replicationLog;
+    }
+
+    void setFollower(Follower *follower) {
+        this->follower = follower;
+    }
+
+    bool isReadOnly() {
+        return follower != nullptr;
+    }
+
+    void setMemoryBudget(MemoryBudget *memoryBudget) {
+        this->memoryBudget = memoryBudget;
+    }
+
+    /*
+     * Estimates of the memory a new lot (besides its description)
+     * and a bet take with their index entries.
+     */
+    static const size_t LOT_MEMORY = 256;
+    static const size_t BET_MEMORY = sizeof(Bet) + 2 * sizeof(void *) + 3 * sizeof(uint32_t);
+
+    /*
+     * False if the storage has used up its budget, new lots and bets
+     * are refused then.
+     */
+    bool hasRoom() {
+        return !memoryBudget || memoryBudget->hasRoom(MemoryLimits::STORAGE);
+    }
+
+    /*
+     * A follower lost its primary for longer than allowed.
+     */
+    bool isStale() {
+        return follower && !follower->isFresh();
+    }
+
+    /*
+     * Applies mutations streamed from the primary.
+     * Throws if they don't fit the state.
+     */
+    void replicate(const std::list<Mutation> &mutations);
+
     uint32_t addNewUser();
 
-    LotFullInfo getLotInfoById(uint32_t lotId);
+    void removeUser(uint32_t uid);
+
+    /*
+     * Returns false if there is no such lot.
+     */
+    bool getLotInfoById(uint32_t lotId, LotFullInfo &lotInfo);
+
+    /*
+     * Same with the version of the lot the copy was taken at.
+     */
+    bool getLotInfoById(uint32_t lotId, LotFullInfo &lotInfo, uint64_t &version);
 
-    uint32_t addNewLot(uint32_t startPrice, uint32_t ownerId, std::string description);
+    /*
+     * Current versions, read without the lock, see ResponseCache.
+     * Returns false if there is no such lot.
+     */
+    bool getLotVersion(uint32_t lotId, uint64_t &version);
+
+    uint64_t getListingVersion() {
+        return listingVersion.load(std::memory_order_acquire);
+    }
+
+    ResponseCache &getResponseCache() {
+        return responseCache;
+    }
+
+    static const unsigned DEADLINE_TICK_MS = 100;
+
+    /*
+     * A lot with a duration in seconds is closed when it runs out,
+     * a bet in the last extension seconds moves its deadline.
+     */
+    uint32_t addNewLot(uint32_t startPrice, uint32_t ownerId, std::string description, uint32_t duration = 0,
+                       uint32_t extension = 0);
 
     std::list<LotShortInfo> getShortInfoList();
 
+    std::list<LotShortInfo> getShortInfoList(uint64_t &version);
+
     bool makeBet(uint32_t uid, const Bet& bet);
 
     bool closeLot(int uid, int lotId);
+
+    /*
+     * Closes timed lots whose deadlines have passed, returns their number.
+     */
+    uint32_t closeExpiredLots();
+
+    bool hasDeadlines() {
+        return scheduledDeadlines.load(std::memory_order_relaxed) > 0;
+    }
+
+    /*
+     * Queries through the indexes, they take time proportional
+     * to the number of lots found.
+     */
+    std::list<LotShortInfo> getOpenLots();
+
+    std::list<LotShortInfo> getLotsByOwner(uint32_t ownerId);
+
+    std::list<LotShortInfo> getLotsByBestPrice(uint32_t minPrice, uint32_t maxPrice);
+
+    /*
+     * Lots whose descriptions match the query, see TextIndex.
+     */
+    std::list<LotShortInfo> searchLots(const std::string &query, uint32_t limit);
+
+    /*
+     * Aggregates of the bets of lots with ids in [firstLotId, lastLotId],
+     * computed without the lock over the bets recorded so far, see BetColumns.
+     * Returns false if the memory it needs doesn't fit the budget.
+     */
+    bool aggregateBets(uint32_t firstLotId, uint32_t lastLotId, BetAggregate &result,
+                       std::vector<LotAggregate> *perLot = nullptr) {
+        return betColumns.aggregate(firstLotId, lastLotId, result, perLot, memoryBudget);
+    }
 };
 
 class TradeConnection {
-    std::thread handlerThread;
     stream_socket *sk;
+    OutboundQueue out;
 
-    void handle();
+public:
+    /*
+     * Estimate of the memory a session holds besides its outbound queue,
+     * charged to the CONNECTIONS category while it lasts.
+     */
+    static const size_t SESSION_MEMORY = 4096;
 
-    static void handleWrapper(TradeConnection *self) {
-        self->handle();
+    TradeConnection(stream_socket *sk, DataStorage *dataStorage, const OutboundQueue::Limits &sendLimits,
+                    const RateLimits &rateLimits, MemoryBudget *memoryBudget, capture_writer *capture = nullptr)
+            : sk(sk), out(sk, sendLimits, memoryBudget), memoryBudget(memoryBudget), capture(capture) {
+        memoryBudget->charge(MemoryLimits::CONNECTIONS, SESSION_MEMORY);
+        context = new Context(dataStorage->addNewUser(), dataStorage, rateLimits);
+        std::cerr << "created new connection CONNECTION_ID:" << context->getUid() << "\n";
     }
 
-public:
-    TradeConnection(stream_socket *sk, DataStorage *dataStorage) : sk(sk) {
-        context = new Context(dataStorage->addNewUser(), dataStorage);
-        handlerThread = std::thread(handleWrapper, this);
-        std::cerr << "created new connection CONNECTION_ID:" << context->getUid() << "\n";
+    /*
+     * Serves the session until the client says bye or the socket fails.
+     */
+    void handle();
+
+    stream_socket *getSocket() {
+        return sk;
     }
 
     ~TradeConnection() {
-        handlerThread.join();
+        context->getDataStorage()->removeUser(context->getUid());
         delete context;
+        memoryBudget->release(MemoryLimits::CONNECTIONS, SESSION_MEMORY);
     }
 
     class Context {
         uint32_t uid;
         DataStorage *dataStorage;
+        uint32_t features = 0;
+        RateLimiter rateLimiter;
 
     public:
-        Context(uint32_t uid, DataStorage *dataStorage) : uid(uid), dataStorage(dataStorage) {}
+        Context(uint32_t uid, DataStorage *dataStorage, const RateLimits &rateLimits)
+                : uid(uid), dataStorage(dataStorage), rateLimiter(rateLimits) {}
 
         uint32_t getUid() {
             return uid;
@@ -66,31 +334,165 @@ public:
         DataStorage *getDataStorage() {
             return dataStorage;
         }
+
+        /*
+         * Protocol features agreed with the client, none until it asks.
+         */
+        void setFeatures(uint32_t features) {
+            this->features = features;
+        }
+
+        bool hasFeature(uint32_t feature) {
+            return (features & feature) != 0;
+        }
+
+        RateLimiter &getRateLimiter() {
+            return rateLimiter;
+        }
     };
 
 private:
     Context *context;
+    MemoryBudget *memoryBudget;
+    capture_writer *capture;
+
+    void record(Packet &packet);
+};
+
+
+struct ServerConfig {
+    const char *ip = DEFAULT_ADDR;
+    tcp_port port = DEFAULT_PORT;
+    /*
+     * Sessions are served by a fixed pool of workers, a session occupies
+     * its worker until it ends. Accepted sessions above the workers count
+     * wait for a free worker, sessions above maxSessions are refused.
+     */
+    size_t workers = DEFAULT_WORKERS;
+    size_t maxSessions = DEFAULT_WORKERS;
+    /*
+     * Every acceptor thread owns its own listening socket,
+     * several acceptors share the address through SO_REUSEPORT.
+     */
+    size_t acceptors = 1;
+    int backlog = tcp_server_socket::DEFAULT_BACKLOG;
+    /*
+     * Serve TCP connections through io_uring instead of blocking syscalls,
+     * falls back to blocking sockets if the kernel can't do it.
+     */
+    bool uring = false;
+    /*
+     * Path of an AF_UNIX socket served along with TCP for local clients.
+     */
+    const char *unixPath = nullptr;
+    /*
+     * Path of the unix socket handing out shared memory channels,
+     * with shmBusyPoll both sides spin instead of sleeping on a futex.
+     */
+    const char *shmPath = nullptr;
+    bool shmBusyPoll = false;
+    /*
+     * Bounds of every connection's outbound queue, see OutboundQueue.
+     */
+    OutboundQueue::Limits sendQueue;
+    /*
+     * Token buckets of every user, requests over the limit are rejected.
+     */
+    RateLimits rateLimits;
+    /*
+     * Urgent storage operations allowed ahead of a waiting bulk read.
+     */
+    unsigned urgentPerBulk = PriorityMutex::DEFAULT_URGENT_PER_BULK;
+    /*
+     * Back the descriptions arena with transparent huge pages.
+     */
+    bool hugePages = false;
+    /*
+     * Apply all updates on one engine thread fed through a command ring
+     * of engineQueue slots, a power of two.
+     */
+    bool engine = false;
+    size_t engineQueue = OrderEngine::DEFAULT_CAPACITY;
+    /*
+     * Serve shard number shard of shards servers sharing the auction,
+     * lot and user ids tell the shard owning them. Followers of a shard
+     * must be started as the same shard.
+     */
+    uint32_t shard = 0;
+    uint32_t shards = 1;
+    /*
+     * Accept only bets beating the current best one, see DataStorage.
+     */
+    bool strictBets = false;
+    /*
+     * Keep a replication log so followers can connect.
+     */
+    bool replicationLog = false;
+    /*
+     * Be a read-only follower of the primary at followAddr:followPort,
+     * reads are refused when it's been silent for maxStalenessMs.
+     */
+    const char *followAddr = nullptr;
+    tcp_port followPort = DEFAULT_PORT;
+    unsigned maxStalenessMs = DEFAULT_MAX_STALENESS_MS;
+    /*
+     * Record every inbound message of every session into this file,
+     * see capture_writer.
+     */
+    const char *capturePath = nullptr;
+    /*
+     * Memory budget of the server, see MemoryBudget. Sessions over it
+     * are refused, requests over it and new lots and bets over the
+     * storage budget are rejected.
+     */
+    MemoryLimits memoryLimits;
+    /*
+     * Limits of what peers may send, set for the whole process.
+     */
+    decode_limits decodeLimits;
 };
 
 
 class TradeServer {
-    tcp_server_socket *serverSocket = nullptr;
-    std::thread listenerThread;
-    std::list<TradeConnection*> connections;
+    ServerConfig config;
+    std::vector<stream_server_socket *> serverSockets;
+    std::vector<std::thread> listenerThreads;
+    WorkerPool workerPool;
+    std::atomic<size_t> activeSessions;
     DataStorage dataStorage;
+    OrderEngine *engine = nullptr;
+    ReplicationLog *replicationLog = nullptr;
+    Follower *follower = nullptr;
+    capture_writer *capture = nullptr;
+    MemoryBudget memoryBudget;
+    SocketBufferAccounting socketBuffers;
+    std::thread expiryThread;
+    std::mutex expiryMtx;
+    std::condition_variable expiryStop;
+    bool stopping = false;
+
+    void closeExpiredLots();
+
+    void listenConnection(stream_server_socket *serverSocket);
 
-    void listenConnection();
+    void serveConnection(TradeConnection *connection, stream_server_socket *serverSocket);
 
-    static void listenConnectionWrapper(TradeServer *self) {
-        self->listenConnection();
+    static void listenConnectionWrapper(TradeServer *self, stream_server_socket *serverSocket) {
+        self->listenConnection(serverSocket);
     }
 
 public:
-    TradeServer(const char* ip, tcp_port port) {
-        serverSocket = new tcp_server_socket(ip, port);
-    }
+    TradeServer(const ServerConfig &config);
 
     void start();
 
+    size_t getActiveSessions() {
+        return activeSessions;
+    }
+
+    MemoryBudget &getMemoryBudget() {
+        return memoryBudget;
+    }
+
     ~TradeServer();
 };
@@ -0,0 +1,67 @@
+#include <iostream>
+#include "worker_pool.h"
+
+
+WorkerPool::WorkerPool(size_t threadsCount) {
+    for (size_t i = 0; i < threadsCount; ++i)
+        threads.push_back(std::thread(workWrapper, this));
+}
+
+
+void WorkerPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            hasTasks.wait(lock, [this] { return stopped || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        try {
+            task();
+        } catch (std::exception &e) {
+            /*
+             * задача не должна ронять рабочий поток,
+             * просто сообщаем об ошибке и берём следующую
+             */
+            std::cerr << "worker: " << e.what() << '\n';
+        }
+    }
+}
+
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        tasks.push_back(std::move(task));
+    }
+    hasTasks.notify_one();
+}
+
+
+size_t WorkerPool::getPendingCount() {
+    std::unique_lock<std::mutex> lock(mtx);
+    return tasks.size();
+}
+
+
+void WorkerPool::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (stopped)
+            return;
+        stopped = true;
+    }
+    hasTasks.notify_all();
+
+    for (auto i = threads.begin(); i != threads.end(); ++i)
+        i->join();
+}
+
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
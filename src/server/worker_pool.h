@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Fixed set of threads executing submitted tasks in FIFO order.
+ * stop() lets the workers finish every task already submitted,
+ * so nothing queued is lost on shutdown.
+ */
+class WorkerPool {
+    std::mutex mtx;
+    std::condition_variable hasTasks;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    bool stopped = false;
+
+    void work();
+
+    static void workWrapper(WorkerPool *self) {
+        self->work();
+    }
+
+public:
+    explicit WorkerPool(size_t threadsCount);
+
+    void submit(std::function<void()> task);
+
+    size_t getPendingCount();
+
+    void stop();
+
+    ~WorkerPool();
+};
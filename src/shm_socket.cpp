@@ -0,0 +1,521 @@
+#include "shm_socket.h"
+#include "unix_socket.h"
+#include "util.h"
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+
+static const uint32_t SHM_MAGIC = 0x54524d31;
+static const uint32_t RING_SIZE = 1 << 16;
+static const unsigned SPINS_BEFORE_SLEEP = 4096;
+static const unsigned SPINS_BETWEEN_PEER_CHECKS = 1 << 20;
+static const unsigned SPINS_BETWEEN_CLOCK_CHECKS = 1 << 10;
+static const long SLEEP_TIMEOUT_NS = 100 * 1000 * 1000;
+
+
+/*
+ * positions grow without bound and are taken modulo RING_SIZE,
+ * consumer and producer fields live in different cache lines
+ */
+struct shm_ring {
+    alignas(64) std::atomic<uint32_t> head;
+    std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> producer_waiting;
+
+    alignas(64) std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> consumer_waiting;
+
+    alignas(64) char data[RING_SIZE];
+
+    shm_ring() : head(0), space_seq(0), producer_waiting(0), tail(0), data_seq(0), consumer_waiting(0) {}
+};
+
+
+struct shm_segment {
+    uint32_t magic;
+    uint32_t busy_poll;
+    std::atomic<uint32_t> closed;
+    shm_ring to_server;
+    shm_ring to_client;
+
+    shm_segment(bool busy_poll) : magic(SHM_MAGIC), busy_poll(busy_poll), closed(0) {}
+};
+
+
+/*
+ * spinning only makes sense when the peer runs on another cpu,
+ * on a single cpu the waiting side gives its time slice to the peer
+ */
+static const bool SINGLE_CPU = std::thread::hardware_concurrency() == 1;
+
+
+static inline void cpu_relax() {
+    if (SINGLE_CPU) {
+        sched_yield();
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+static void futex_wait(std::atomic<uint32_t> &word, uint32_t expected, long timeout_ns) {
+    timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = timeout_ns;
+    syscall(SYS_futex, (uint32_t *) &word, FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+
+static void futex_wake(std::atomic<uint32_t> &word) {
+    syscall(SYS_futex, (uint32_t *) &word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+
+/*
+ * wakes the other side if it has announced that it's going to sleep,
+ * the fence pairs with the one in wait_for
+ */
+static void notify(std::atomic<uint32_t> &waiting, std::atomic<uint32_t> &seq) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)) {
+        seq.fetch_add(1, std::memory_order_relaxed);
+        futex_wake(seq);
+    }
+}
+
+
+/*
+ * waits until ready() holds, returns false if the channel is closed,
+ * the peer is gone or timeout_ms passes before that;
+ * a negative timeout means no timeout
+ */
+template <typename Ready>
+static bool wait_for(shm_segment *segment, std::atomic<uint32_t> &waiting, std::atomic<uint32_t> &seq,
+                     Ready ready, std::function<bool()> peer_gone, int timeout_ms = -1) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    unsigned spins = 0;
+
+    while (true) {
+        if (ready())
+            return true;
+        if (segment->closed.load(std::memory_order_acquire))
+            return ready();
+
+        if (segment->busy_poll || (!SINGLE_CPU && spins < SPINS_BEFORE_SLEEP)) {
+            cpu_relax();
+            if (++spins % SPINS_BETWEEN_PEER_CHECKS == 0 && peer_gone())
+                return ready();
+            if (timeout_ms >= 0 && spins % SPINS_BETWEEN_CLOCK_CHECKS == 0
+                && std::chrono::steady_clock::now() >= deadline)
+                return ready();
+            continue;
+        }
+
+        long sleep_ns = SLEEP_TIMEOUT_NS;
+        if (timeout_ms >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+                return ready();
+            sleep_ns = std::min<long>(sleep_ns, (long) left.count());
+        }
+
+        uint32_t observed = seq.load(std::memory_order_relaxed);
+        waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!ready() && !segment->closed.load(std::memory_order_acquire)) {
+            futex_wait(seq, observed, sleep_ns);
+            if (!ready() && peer_gone()) {
+                waiting.store(0, std::memory_order_relaxed);
+                return ready();
+            }
+        }
+
+        waiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+/*
+ * shm_channel implementation
+ */
+
+shm_channel::shm_channel(shm_segment *segment, int control_sk, bool server_side)
+        : segment(segment), control_sk(control_sk), server_side(server_side) {}
+
+
+bool shm_channel::peer_gone() {
+    pollfd pfd;
+    pfd.fd = control_sk;
+    pfd.events = POLLIN | POLLRDHUP;
+    pfd.revents = 0;
+
+    /*
+     * после рукопожатия по управляющему сокету ничего не передаётся,
+     * так что любое событие на нём означает, что собеседник отключился
+     */
+    if (poll(&pfd, 1, 0) > 0) {
+        close_segment();
+        return true;
+    }
+    return false;
+}
+
+
+void shm_channel::close_segment() {
+    segment->closed.store(1, std::memory_order_release);
+
+    for (shm_ring *ring : {&segment->to_server, &segment->to_client}) {
+        ring->data_seq.fetch_add(1);
+        futex_wake(ring->data_seq);
+        ring->space_seq.fetch_add(1);
+        futex_wake(ring->space_seq);
+    }
+}
+
+
+size_t shm_channel::send_some(const void *buf, size_t size) {
+    if (segment->closed.load(std::memory_order_acquire))
+        throw std::runtime_error("can't send all data");
+
+    shm_ring &ring = server_side ? segment->to_client : segment->to_server;
+    const char *data = (const char *) buf;
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint32_t space = RING_SIZE - (tail - ring.head.load(std::memory_order_acquire));
+    size_t sent = 0;
+
+    /*
+     * свободное место может переходить через конец кольца,
+     * тогда копируем в два приёма
+     */
+    while (size && space) {
+        uint32_t offset = tail % RING_SIZE;
+        uint32_t chunk = (uint32_t) std::min<size_t>(std::min(space, RING_SIZE - offset), size);
+
+        memcpy(ring.data + offset, data, chunk);
+        tail += chunk;
+        data += chunk;
+        size -= chunk;
+        space -= chunk;
+        sent += chunk;
+    }
+
+    if (sent) {
+        ring.tail.store(tail, std::memory_order_release);
+        notify(ring.consumer_waiting, ring.data_seq);
+    }
+
+    return sent;
+}
+
+
+bool shm_channel::wait_writable(int timeout_ms) {
+    shm_ring &ring = server_side ? segment->to_client : segment->to_server;
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+
+    auto has_space = [&ring, tail] { return tail - ring.head.load(std::memory_order_acquire) < RING_SIZE; };
+    return wait_for(segment, ring.producer_waiting, ring.space_seq, has_space, [this] { return peer_gone(); },
+                    timeout_ms)
+           || segment->closed.load(std::memory_order_acquire);
+}
+
+
+void shm_channel::send(const void *buf, size_t size) {
+    const char *data = (const char *) buf;
+
+    while (size) {
+        size_t sent = send_some(data, size);
+        data += sent;
+        size -= sent;
+
+        if (size)
+            wait_writable(-1);
+    }
+}
+
+
+void shm_channel::recv(void *buf, size_t size) {
+    shm_ring &ring = server_side ? segment->to_server : segment->to_client;
+    char *data = (char *) buf;
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+
+    while (size) {
+        auto has_data = [&ring, head] { return ring.tail.load(std::memory_order_acquire) != head; };
+        if (!wait_for(segment, ring.consumer_waiting, ring.data_seq, has_data, [this] { return peer_gone(); }))
+            throw std::runtime_error("can't receive all data");
+
+        uint32_t available = ring.tail.load(std::memory_order_acquire) - head;
+        uint32_t offset = head % RING_SIZE;
+        uint32_t chunk = (uint32_t) std::min<size_t>(std::min(available, RING_SIZE - offset), size);
+
+        memcpy(data, ring.data + offset, chunk);
+        head += chunk;
+        data += chunk;
+        size -= chunk;
+
+        ring.head.store(head, std::memory_order_release);
+        notify(ring.producer_waiting, ring.space_seq);
+    }
+}
+
+
+void shm_channel::close() {
+    close_segment();
+    ::shutdown(control_sk, SHUT_RDWR);
+}
+
+
+shm_channel::~shm_channel() {
+    close();
+    ::close(control_sk);
+    munmap(segment, sizeof(shm_segment));
+}
+
+
+/*
+ * shm_server_socket implementation
+ */
+
+shm_server_socket::shm_server_socket(const char *path, bool busy_poll, int backlog)
+        : fd_server_socket("shm server socket"), busy_poll(busy_poll) {
+    sk = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    init_unixaddr(path, unixaddr);
+
+    if (sk < 0) {
+        err_msg = "can't create socket";
+        perror(err_msg);
+        return;
+    }
+
+    if (!remove_stale_unix_socket(unixaddr)) {
+        err_msg = "can't bind socket, the path is in use";
+        perror(err_msg);
+        return;
+    }
+
+    if (bind(sk, (const sockaddr *) &unixaddr, sizeof(unixaddr)) < 0) {
+        err_msg = "can't bind socket";
+        perror(err_msg);
+        return;
+    }
+    bound = true;
+
+    if (listen(sk, backlog) < 0) {
+        err_msg = "can't listen";
+        perror(err_msg);
+        return;
+    }
+}
+
+
+shm_channel *shm_server_socket::handshake(int client_sk) {
+    int memfd = (int) syscall(SYS_memfd_create, "trade-shm", MFD_CLOEXEC);
+    if (memfd < 0)
+        return nullptr;
+
+    void *mem = MAP_FAILED;
+    if (ftruncate(memfd, sizeof(shm_segment)) == 0)
+        mem = mmap(nullptr, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (mem == MAP_FAILED) {
+        ::close(memfd);
+        return nullptr;
+    }
+    shm_segment *segment = new(mem) shm_segment(busy_poll);
+
+    char byte = 0;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    ssize_t sent = sendmsg(client_sk, &msg, MSG_NOSIGNAL);
+    ::close(memfd);
+
+    if (sent != 1) {
+        munmap(segment, sizeof(shm_segment));
+        return nullptr;
+    }
+
+    return new shm_channel(segment, client_sk, true);
+}
+
+
+stream_socket *shm_server_socket::make_client(int client_sk) {
+    shm_channel *channel = handshake(client_sk);
+    if (!channel) {
+        /*
+         * не смогли передать клиенту сегмент,
+         * отказываемся от него и принимаем следующего
+         */
+        perror("shm handshake failed");
+        ::close(client_sk);
+        return nullptr;
+    }
+
+    return new shm_connection_socket(channel);
+}
+
+
+void shm_server_socket::shutdown_client(stream_socket *client) {
+    ((shm_connection_socket *) client)->channel->close();
+}
+
+
+void shm_server_socket::listener_closed() {
+    if (bound)
+        ::unlink(unixaddr.sun_path);
+}
+
+
+shm_server_socket::~shm_server_socket() {
+    if (sk >= 0)
+        close();
+}
+
+
+/*
+ * shm_connection_socket implementation
+ */
+
+void shm_connection_socket::send(const void *buf, size_t size) {
+    channel->send(buf, size);
+}
+
+
+void shm_connection_socket::recv(void *buf, size_t size) {
+    channel->recv(buf, size);
+}
+
+
+size_t shm_connection_socket::send_nonblocking(const void *buf, size_t size) {
+    return channel->send_some(buf, size);
+}
+
+
+bool shm_connection_socket::wait_writable(int timeout_ms) {
+    return channel->wait_writable(timeout_ms);
+}
+
+
+shm_connection_socket::~shm_connection_socket() {
+    delete channel;
+}
+
+
+/*
+ * shm_client_socket implementation
+ */
+
+shm_client_socket::shm_client_socket(const char *path) {
+    init_unixaddr(path, unixaddr);
+}
+
+
+void shm_client_socket::connect() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (channel) return;
+
+    if (err_msg)
+        throw std::runtime_error(err_msg);
+
+    int sk = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sk < 0 || ::connect(sk, (sockaddr *) &unixaddr, sizeof(unixaddr)) < 0) {
+        err_msg = "can't connect";
+        perror(err_msg);
+        if (sk >= 0)
+            ::close(sk);
+        throw std::runtime_error(err_msg);
+    }
+
+    char byte;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int memfd = -1;
+    if (recvmsg(sk, &msg, MSG_CMSG_CLOEXEC) == 1) {
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    void *mem = MAP_FAILED;
+    if (memfd >= 0) {
+        mem = mmap(nullptr, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        ::close(memfd);
+    }
+
+    if (mem == MAP_FAILED || ((shm_segment *) mem)->magic != SHM_MAGIC) {
+        err_msg = "can't map shared memory segment";
+        perror(err_msg);
+        if (mem != MAP_FAILED)
+            munmap(mem, sizeof(shm_segment));
+        ::close(sk);
+        throw std::runtime_error(err_msg);
+    }
+
+    channel = new shm_channel((shm_segment *) mem, sk, false);
+}
+
+
+void shm_client_socket::send(const void *buf, size_t size) {
+    if (!channel)
+        throw std::runtime_error("not connected");
+    channel->send(buf, size);
+}
+
+
+void shm_client_socket::recv(void *buf, size_t size) {
+    if (!channel)
+        throw std::runtime_error("not connected");
+    channel->recv(buf, size);
+}
+
+
+shm_client_socket::~shm_client_socket() {
+    delete channel;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "fd_socket.h"
+
+#include <sys/un.h>
+
+#include <atomic>
+
+/*
+ * Stream sockets over a pair of single-producer single-consumer rings
+ * in shared memory, for clients on the same host.
+ *
+ * A client connects to a unix socket at the server path, the server
+ * creates a memfd segment with both rings and passes the descriptor back
+ * with SCM_RIGHTS. After that the data never goes through the kernel:
+ * a side waiting for data or free space spins for a while and then
+ * sleeps on a futex in the segment, the other side wakes it only if
+ * it's actually asleep. In busy-poll mode waiting sides never sleep.
+ * The unix socket stays open, so a side notices when its peer dies.
+ */
+
+struct shm_segment;
+
+class shm_channel {
+    shm_segment *segment;
+    int control_sk;
+    bool server_side;
+
+    bool peer_gone();
+
+    void close_segment();
+
+public:
+    shm_channel(shm_segment *segment, int control_sk, bool server_side);
+
+    void send(const void *buf, size_t size);
+
+    /*
+     * Copies what fits into the free space of the ring without waiting,
+     * returns the number of bytes taken.
+     */
+    size_t send_some(const void *buf, size_t size);
+
+    /*
+     * Waits up to timeout_ms for free space in the ring, a negative
+     * timeout waits without limit. Returns true on a closed channel
+     * too, the next send throws then.
+     */
+    bool wait_writable(int timeout_ms);
+
+    void recv(void *buf, size_t size);
+
+    /*
+     * Marks the channel closed for both sides and wakes the peer.
+     */
+    void close();
+
+    ~shm_channel();
+};
+
+
+class shm_connection_socket;
+
+class shm_server_socket : public fd_server_socket {
+    sockaddr_un unixaddr;
+    bool bound = false;
+    bool busy_poll;
+
+    shm_channel *handshake(int client_sk);
+
+protected:
+    stream_socket *make_client(int client_sk) override;
+
+    void shutdown_client(stream_socket *client) override;
+
+    void listener_closed() override;
+
+public:
+    shm_server_socket(const char *path, bool busy_poll = false, int backlog = SOMAXCONN);
+
+    ~shm_server_socket() override;
+};
+
+
+class shm_connection_socket : public stream_socket {
+    shm_channel *channel;
+
+    shm_connection_socket(shm_channel *channel) : channel(channel) {}
+
+    friend class shm_server_socket;
+
+public:
+    void send(const void *buf, size_t size) override;
+
+    void recv(void *buf, size_t size) override;
+
+    size_t send_nonblocking(const void *buf, size_t size) override;
+
+    bool wait_writable(int timeout_ms) override;
+
+    ~shm_connection_socket() override;
+};
+
+
+class shm_client_socket : public stream_client_socket {
+    sockaddr_un unixaddr;
+    std::mutex mtx;
+    const char *err_msg = nullptr;
+    shm_channel *channel = nullptr;
+
+public:
+    shm_client_socket(const char *path);
+
+    void send(const void *buf, size_t size) override;
+
+    void recv(void *buf, size_t size) override;
+
+    void connect() override;
+
+    ~shm_client_socket() override;
+};
@@ -30,9 +30,44 @@ struct stream_socket {
      */
     virtual void recv(void *buf, size_t size) = 0;
 
+    /*
+     * Sends as much of buf as the socket takes without blocking
+     * and returns the number of bytes sent, throws like send.
+     * Sockets that can't do it just send everything.
+     */
+    virtual size_t send_nonblocking(const void *buf, size_t size) {
+        send(buf, size);
+        return size;
+    }
+
+    /*
+     * Waits up to timeout_ms until send_nonblocking can take more data,
+     * returns false on timeout.
+     */
+    virtual bool wait_writable(int /*timeout_ms*/) {
+        return true;
+    }
+
+    /*
+     * Delivers data buffered by the socket itself, if any.
+     */
+    virtual void flush() {}
+
     virtual ~stream_socket() {};
 };
 
+/*
+ * Receives the changes of memory sockets hold on behalf of their peers,
+ * such as received data nobody has read yet. Called from any thread.
+ */
+struct buffer_accounting {
+    virtual void charge(size_t bytes) = 0;
+
+    virtual void release(size_t bytes) = 0;
+
+    virtual ~buffer_accounting() {};
+};
+
 struct stream_client_socket : stream_socket {
     /*
      * If exception is thrown then this socket would probably
@@ -48,6 +83,24 @@ struct stream_server_socket {
      */
     virtual stream_socket *accept_one_client() = 0;
 
+    /*
+     * Closes and frees a socket returned by accept_one_client.
+     * The socket mustn't be used after this call.
+     */
+    virtual void release_client(stream_socket *client) = 0;
+
+    /*
+     * Sockets buffering incoming data charge it here, others ignore it.
+     * Must be set before the first accept.
+     */
+    virtual void set_buffer_accounting(buffer_accounting * /*accounting*/) {}
+
+    /*
+     * Stops listening and shuts down all the accepted sockets that
+     * haven't been released yet. Blocked accept_one_client calls throw.
+     */
+    virtual void close() = 0;
+
     virtual ~stream_server_socket() {};
 };
 
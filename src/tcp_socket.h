@@ -1,72 +1,30 @@
 #pragma once
 
-#include "stream_socket.h"
+#include "fd_socket.h"
 
-#include <sys/socket.h>
-#include <sys/types.h>
-
-#include <exception>
-#include <mutex>
 #include <netinet/in.h>
-#include <list>
-
-class tcp_connection_socket;
 
-class tcp_server_socket : public stream_server_socket {
-    const static int BACKLOG = 5;
-    int sk = -1;
-    const char *err_msg = nullptr;
-    std::mutex mtx;
+/*
+ * With reuse_port several server sockets may listen on the same address,
+ * the kernel spreads incoming connections between them.
+ */
+class tcp_server_socket : public fd_server_socket {
     sockaddr_in ipv4addr;
-    std::list<tcp_connection_socket *> acceptedSockets;
 
 public:
-    tcp_server_socket(const char *addr, uint16_t port);
-
-    stream_socket *accept_one_client() override;
+    const static int DEFAULT_BACKLOG = SOMAXCONN;
 
-    void close();
-
-    ~tcp_server_socket() override;
+    tcp_server_socket(const char *addr, uint16_t port, int backlog = DEFAULT_BACKLOG, bool reuse_port = false);
 };
 
 
-class tcp_connection_socket : public stream_socket {
-    int sk;
-    const char *err_msg = nullptr;
-    std::mutex mtx;
-    bool closed = false;
-
-    tcp_connection_socket(int sk);
-
-    friend stream_socket *tcp_server_socket::accept_one_client();
-
-public:
-    void send(const void *buf, size_t size) override;
-
-    void recv(void *buf, size_t size) override;
-
-    void close();
-
-    ~tcp_connection_socket();
-};
-
-
-class tcp_client_socket : public stream_client_socket {
-    int sk;
-    const char *err_msg = nullptr;
-    std::mutex mtx;
-    sockaddr_in ipv4addr;
-    bool connected = false;
-
+class tcp_client_socket : public fd_client_socket {
 public:
     tcp_client_socket(const char *addr, uint16_t port);
 
-    void send(const void *buf, size_t size) override;
-
-    void recv(void *buf, size_t size) override;
-
-    void connect() override;
-
-    ~tcp_client_socket() override;
+    /*
+     * Breaks blocked and further sends and receives, may be called
+     * from another thread.
+     */
+    void shutdown();
 };
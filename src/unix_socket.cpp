@@ -0,0 +1,108 @@
+#include "unix_socket.h"
+#include "util.h"
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+
+void init_unixaddr(const char *path, sockaddr_un &unixaddr) {
+    memset(&unixaddr, 0, sizeof(unixaddr));
+    unixaddr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(unixaddr.sun_path))
+        throw std::runtime_error("unix socket path is too long");
+    strcpy(unixaddr.sun_path, path);
+}
+
+
+bool remove_stale_unix_socket(const sockaddr_un &unixaddr) {
+    struct stat st;
+    if (lstat(unixaddr.sun_path, &st) < 0)
+        return errno == ENOENT;
+
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = EEXIST;
+        return false;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (probe < 0)
+        return false;
+
+    /*
+     * файл остался от упавшего процесса, только если к нему никто не слушает:
+     * заполненная очередь живого сервера даёт EAGAIN, а не ECONNREFUSED
+     */
+    int rc = ::connect(probe, (const sockaddr *) &unixaddr, sizeof(unixaddr));
+    int connect_errno = errno;
+    ::close(probe);
+
+    if (rc == 0 || connect_errno != ECONNREFUSED) {
+        errno = rc == 0 ? EADDRINUSE : connect_errno;
+        return false;
+    }
+
+    return ::unlink(unixaddr.sun_path) == 0 || errno == ENOENT;
+}
+
+
+/*
+ * unix_client_socket implementation
+ */
+
+unix_client_socket::unix_client_socket(const char *path)
+        : fd_client_socket(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) {
+    sockaddr_un unixaddr;
+    init_unixaddr(path, unixaddr);
+    memcpy(&addr, &unixaddr, sizeof(unixaddr));
+    addr_len = sizeof(unixaddr);
+}
+
+
+/*
+ * unix_server_socket implementation
+ */
+
+unix_server_socket::unix_server_socket(const char *path, int backlog) : fd_server_socket("unix server socket") {
+    sk = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    init_unixaddr(path, unixaddr);
+
+    if (sk < 0) {
+        err_msg = "can't create socket";
+        perror(err_msg);
+        return;
+    }
+
+    if (!remove_stale_unix_socket(unixaddr)) {
+        err_msg = "can't bind socket, the path is in use";
+        perror(err_msg);
+        return;
+    }
+
+    if (bind(sk, (const sockaddr *) &unixaddr, sizeof(unixaddr)) < 0) {
+        err_msg = "can't bind socket";
+        perror(err_msg);
+        return;
+    }
+    bound = true;
+
+    if (listen(sk, backlog) < 0) {
+        err_msg = "can't listen";
+        perror(err_msg);
+        return;
+    }
+}
+
+
+void unix_server_socket::listener_closed() {
+    if (bound)
+        ::unlink(unixaddr.sun_path);
+}
+
+
+unix_server_socket::~unix_server_socket() {
+    if (sk >= 0)
+        close();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "fd_socket.h"
+
+#include <sys/un.h>
+
+/*
+ * Stream sockets over AF_UNIX for clients on the same host,
+ * addressed by a filesystem path.
+ */
+
+class unix_server_socket : public fd_server_socket {
+    sockaddr_un unixaddr;
+    bool bound = false;
+
+protected:
+    void listener_closed() override;
+
+public:
+    const static int DEFAULT_BACKLOG = SOMAXCONN;
+
+    /*
+     * A stale socket file left at path by a previous run is removed,
+     * a path held by a live listener or by anything but a socket fails the bind.
+     */
+    unix_server_socket(const char *path, int backlog = DEFAULT_BACKLOG);
+
+    ~unix_server_socket() override;
+};
+
+
+class unix_client_socket : public fd_client_socket {
+public:
+    unix_client_socket(const char *path);
+};
+
+
+void init_unixaddr(const char *path, sockaddr_un &unixaddr);
+
+/*
+ * Frees the path of unixaddr for bind: removes a socket file nobody
+ * accepts connections on. Returns false with errno set if the path is
+ * taken by a live listener or by something that isn't a socket.
+ */
+bool remove_stale_unix_socket(const sockaddr_un &unixaddr);
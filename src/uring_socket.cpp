@@ -0,0 +1,948 @@
+#include "uring_socket.h"
+#include "util.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+const unsigned uring_server_socket::RING_ENTRIES;
+const unsigned uring_server_socket::RECV_BUFFERS;
+const size_t uring_server_socket::RECV_BUFFER_SIZE;
+const unsigned uring_server_socket::SEND_SLOTS;
+const size_t uring_server_socket::SEND_SLOT_SIZE;
+const size_t uring_server_socket::RECV_HIGH_WATERMARK;
+const size_t uring_server_socket::RECV_LOW_WATERMARK;
+const int uring_server_socket::RELEASE_SEND_TIMEOUT_MS;
+
+
+/*
+ * user_data of every SQE keeps the operation in the high byte
+ * and the connection id in the rest
+ */
+enum uring_op {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL,
+    OP_STOP
+};
+
+static const int OP_SHIFT = 56;
+static const uint64_t ID_MASK = (1ULL << OP_SHIFT) - 1;
+static const uint16_t BUFFER_GROUP = 0;
+/*
+ * how long the reaper waits for completions while it has deferred SQEs
+ */
+static const long DEFERRED_RETRY_NS = 1000 * 1000;
+
+
+static uint64_t make_user_data(uint64_t op, uint64_t id) {
+    return (op << OP_SHIFT) | id;
+}
+
+
+/*
+ * raw io_uring: syscalls and the mapped rings
+ */
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+
+/*
+ * waits for a completion at most timeout_ns, fails with ETIME on timeout
+ */
+static int sys_io_uring_wait(int fd, long timeout_ns) {
+    __kernel_timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = timeout_ns;
+
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    return (int) syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                         &arg, sizeof(arg));
+}
+
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+struct uring_ring {
+    int fd = -1;
+
+    void *sq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    void *cq_ptr = MAP_FAILED;
+    size_t cq_len = 0;
+    io_uring_sqe *sqes = (io_uring_sqe *) MAP_FAILED;
+    size_t sqes_len = 0;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+
+    /*
+     * SQEs are filled and submitted under sq_mtx,
+     * sq_pending counts the filled ones the kernel hasn't taken yet
+     */
+    std::mutex sq_mtx;
+    unsigned sq_pending = 0;
+
+    io_uring_buf_ring *buf_ring = (io_uring_buf_ring *) MAP_FAILED;
+    size_t buf_ring_len = 0;
+    unsigned buf_mask = 0;
+    uint16_t buf_tail = 0;
+
+    bool buffers_registered = false;
+};
+
+
+static bool ring_setup(uring_ring *ring, unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0)
+        return false;
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sq_len = ring->cq_len = std::max(ring->sq_len, ring->cq_len);
+
+    ring->sq_ptr = mmap(nullptr, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        return false;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(nullptr, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            return false;
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe *) mmap(nullptr, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        return false;
+
+    char *sq = (char *) ring->sq_ptr;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *) (sq + params.sq_off.ring_entries);
+
+    char *cq = (char *) ring->cq_ptr;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return true;
+}
+
+
+static void ring_destroy(uring_ring *ring) {
+    if (ring->buf_ring != MAP_FAILED)
+        munmap(ring->buf_ring, ring->buf_ring_len);
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_len);
+    if (ring->fd >= 0)
+        ::close(ring->fd);
+    delete ring;
+}
+
+
+/*
+ * submits everything filled so far, sq_mtx must be held
+ */
+static void ring_submit(uring_ring *ring) {
+    while (ring->sq_pending) {
+        int submitted = sys_io_uring_enter(ring->fd, ring->sq_pending, 0, 0);
+        if (submitted < 0) {
+            if (errno == EINTR)
+                continue;
+            /*
+             * например, переполнена очередь завершений,
+             * оставшиеся SQE отправит поток, разбирающий завершения
+             */
+            return;
+        }
+        ring->sq_pending -= submitted;
+    }
+}
+
+
+/*
+ * returns a zeroed SQE which will be submitted by the next ring_submit
+ * or nullptr if the submission queue is full, sq_mtx must be held
+ */
+static io_uring_sqe *ring_try_next_sqe(uring_ring *ring) {
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        ring_submit(ring);
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+            return nullptr;
+    }
+
+    unsigned index = tail & ring->sq_mask;
+    io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->sq_pending;
+
+    return sqe;
+}
+
+
+/*
+ * the buffers array is addressed by hand: in C++ the flexible array member
+ * of io_uring_buf_ring is preceded by an empty struct and doesn't start at 0
+ */
+static void ring_add_buffer(uring_ring *ring, char *buffers, size_t size, uint16_t bid) {
+    io_uring_buf *buf = (io_uring_buf *) ring->buf_ring + (ring->buf_tail & ring->buf_mask);
+    buf->addr = (uint64_t) (uintptr_t) (buffers + bid * size);
+    buf->len = (uint32_t) size;
+    buf->bid = bid;
+    ++ring->buf_tail;
+}
+
+
+static void ring_publish_buffers(uring_ring *ring) {
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * uring_server_socket implementation
+ */
+
+uring_server_socket::uring_server_socket(const char *addr, tcp_port port, int backlog, bool reuse_port)
+        : zero_copy(true) {
+    ring = new uring_ring();
+
+    try {
+        if (!ring_setup(ring, RING_ENTRIES))
+            throw std::runtime_error("can't set up io_uring");
+
+        recv_buffers = (char *) mmap(nullptr, RECV_BUFFERS * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        send_slots = (char *) mmap(nullptr, SEND_SLOTS * SEND_SLOT_SIZE, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (recv_buffers == MAP_FAILED || send_slots == MAP_FAILED)
+            throw std::runtime_error("can't allocate io_uring buffers");
+
+        ring->buf_ring_len = RECV_BUFFERS * sizeof(io_uring_buf);
+        ring->buf_ring = (io_uring_buf_ring *) mmap(nullptr, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+                                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring->buf_ring == MAP_FAILED)
+            throw std::runtime_error("can't allocate io_uring buffer ring");
+        ring->buf_mask = RECV_BUFFERS - 1;
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t) (uintptr_t) ring->buf_ring;
+        reg.ring_entries = RECV_BUFFERS;
+        reg.bgid = BUFFER_GROUP;
+        if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            throw std::runtime_error("can't register io_uring provided buffers");
+
+        for (unsigned i = 0; i < RECV_BUFFERS; ++i)
+            ring_add_buffer(ring, recv_buffers, RECV_BUFFER_SIZE, (uint16_t) i);
+        ring_publish_buffers(ring);
+
+        std::vector<iovec> iovecs(SEND_SLOTS);
+        for (unsigned i = 0; i < SEND_SLOTS; ++i) {
+            iovecs[i].iov_base = send_slots + i * SEND_SLOT_SIZE;
+            iovecs[i].iov_len = SEND_SLOT_SIZE;
+            free_slots.push_back(SEND_SLOTS - 1 - i);
+        }
+        /*
+         * без зарегистрированных буферов (например, мал RLIMIT_MEMLOCK)
+         * слоты остаются обычной памятью и отправляются без zero-copy
+         */
+        ring->buffers_registered =
+                sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovecs.data(), SEND_SLOTS) == 0;
+        zero_copy = ring->buffers_registered;
+    } catch (...) {
+        if (recv_buffers && recv_buffers != MAP_FAILED)
+            munmap(recv_buffers, RECV_BUFFERS * RECV_BUFFER_SIZE);
+        if (send_slots && send_slots != MAP_FAILED)
+            munmap(send_slots, SEND_SLOTS * SEND_SLOT_SIZE);
+        ring_destroy(ring);
+        throw;
+    }
+
+    sk = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    init_ipv4addr(addr, port, ipv4addr);
+
+    int optval = 1;
+    if (setsockopt(sk, SOL_SOCKET, SO_REUSEADDR, (void *) &optval, sizeof(int)) < 0) {
+        err_msg = "can't set SO_REUSEADDR";
+        perror(err_msg);
+    } else if (reuse_port && setsockopt(sk, SOL_SOCKET, SO_REUSEPORT, (void *) &optval, sizeof(int)) < 0) {
+        err_msg = "can't set SO_REUSEPORT";
+        perror(err_msg);
+    } else if (bind(sk, (const sockaddr *) &ipv4addr, sizeof(ipv4addr)) < 0) {
+        err_msg = "can't bind socket";
+        perror(err_msg);
+    } else if (listen(sk, backlog) < 0) {
+        err_msg = "can't listen";
+        perror(err_msg);
+    } else {
+        std::unique_lock<std::mutex> lock(mtx);
+        std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+        prepare_or_defer(make_user_data(OP_ACCEPT, 0));
+        ring_submit(ring);
+    }
+
+    reaper = std::thread(reap_wrapper, this);
+}
+
+
+/*
+ * fills the SQE of a multishot accept, a multishot recv, a send of the
+ * unsent part of a connection's buffer or a cancel of the recv,
+ * returns false if there's no room for it;
+ * the prepare functions only fill SQEs, mtx and sq_mtx must be held
+ */
+bool uring_server_socket::prepare(uint64_t user_data) {
+    uint64_t op = user_data >> OP_SHIFT;
+    uint64_t id = user_data & ID_MASK;
+    int fd = sk;
+    uring_connection_socket *connection = nullptr;
+
+    if (op == OP_ACCEPT && closed)
+        return true;
+    if (op == OP_RECV || op == OP_SEND) {
+        auto found = connections.find(id);
+        if (found == connections.end())
+            return true;
+        connection = found->second;
+        fd = connection->sk;
+    }
+
+    io_uring_sqe *sqe = ring_try_next_sqe(ring);
+    if (!sqe)
+        return false;
+
+    if (op == OP_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+    } else if (op == OP_RECV) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+    } else if (op == OP_SEND) {
+        std::unique_lock<std::mutex> lock(connection->mtx);
+
+        connection->send_zero_copy = connection->slot >= 0 && zero_copy;
+        if (connection->send_zero_copy) {
+            sqe->opcode = IORING_OP_SEND_ZC;
+            sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = (uint16_t) connection->slot;
+        } else {
+            sqe->opcode = IORING_OP_SEND;
+        }
+        sqe->fd = fd;
+        sqe->addr = (uint64_t) (uintptr_t) (connection->out_buf + connection->out_sent);
+        sqe->len = (uint32_t) (connection->out_len - connection->out_sent);
+        sqe->msg_flags = MSG_NOSIGNAL;
+    } else {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = make_user_data(OP_RECV, id);
+    }
+    sqe->user_data = user_data;
+
+    return true;
+}
+
+
+void uring_server_socket::prepare_or_defer(uint64_t user_data) {
+    if (!prepare(user_data))
+        deferred.push_back(user_data);
+}
+
+
+void uring_server_socket::prepare_deferred() {
+    std::vector<uint64_t> left;
+    for (auto i = deferred.begin(); i != deferred.end(); ++i) {
+        if (!prepare(*i))
+            left.push_back(*i);
+    }
+    deferred.swap(left);
+}
+
+
+/*
+ * restarts the recv stopped at the high watermark
+ */
+void uring_server_socket::resume_recv(uring_connection_socket *connection) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    /*
+     * остановленный recv ещё не завершился,
+     * его перезапустит поток, разбирающий завершения
+     */
+    if (connection->recv_armed)
+        return;
+    connection->recv_armed = true;
+
+    std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+    prepare_or_defer(make_user_data(OP_RECV, connection->id));
+    ring_submit(ring);
+}
+
+
+/*
+ * a send that doesn't get an SQE now is prepared by the reaper later,
+ * so the connection never waits for room in the submission queue
+ */
+void uring_server_socket::submit_send(uring_connection_socket *connection) {
+    std::unique_lock<std::mutex> lock(mtx);
+    std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+
+    prepare_or_defer(make_user_data(OP_SEND, connection->id));
+    ring_submit(ring);
+}
+
+
+/*
+ * ring is unusable, wakes everyone waiting for it, mtx must be held
+ */
+void uring_server_socket::fail(const char *msg) {
+    err_msg = msg;
+    perror(err_msg);
+
+    for (auto i = connections.begin(); i != connections.end(); ++i) {
+        uring_connection_socket *connection = i->second;
+        std::unique_lock<std::mutex> lock(connection->mtx);
+        connection->error = EIO;
+        connection->send_pending = false;
+        connection->notifs_pending = 0;
+        connection->changed.notify_all();
+    }
+    has_accepted.notify_all();
+}
+
+
+void uring_server_socket::reap() {
+    while (true) {
+        bool has_deferred;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            has_deferred = !deferred.empty();
+        }
+
+        int res = has_deferred ? sys_io_uring_wait(ring->fd, DEFERRED_RETRY_NS)
+                               : sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (res < 0 && errno != EINTR && errno != ETIME) {
+            std::unique_lock<std::mutex> lock(mtx);
+            fail("can't wait for io_uring completions");
+            return;
+        }
+
+        bool stop = false;
+        bool recycled = false;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+
+            unsigned head = *ring->cq_head;
+            unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; ++head) {
+                io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+                uint64_t op = cqe->user_data >> OP_SHIFT;
+                uint64_t id = cqe->user_data & ID_MASK;
+                bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+                if (op == OP_ACCEPT) {
+                    if (cqe->res >= 0) {
+                        if (closed) {
+                            ::close(cqe->res);
+                        } else {
+                            accepted.push_back(cqe->res);
+                            has_accepted.notify_one();
+                        }
+                    } else if (cqe->res == -EINVAL && !closed) {
+                        fail("can't accept");
+                        continue;
+                    }
+                    if (!more && !closed)
+                        deferred.push_back(make_user_data(OP_ACCEPT, 0));
+                } else if (op == OP_RECV) {
+                    auto found = connections.find(id);
+                    uring_connection_socket *connection = found != connections.end() ? found->second : nullptr;
+                    const char *data = nullptr;
+                    bool paused = false;
+
+                    if (cqe->flags & IORING_CQE_F_BUFFER) {
+                        uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                        data = recv_buffers + bid * RECV_BUFFER_SIZE;
+                        if (connection)
+                            paused = connection->on_recv(data, cqe->res);
+                        ring_add_buffer(ring, recv_buffers, RECV_BUFFER_SIZE, bid);
+                        recycled = true;
+                    } else if (connection) {
+                        paused = connection->on_recv(nullptr, cqe->res);
+                    }
+
+                    if (connection && more) {
+                        if (paused && !connection->recv_cancelling) {
+                            connection->recv_cancelling = true;
+                            deferred.push_back(make_user_data(OP_CANCEL, id));
+                        }
+                    } else if (connection) {
+                        connection->recv_cancelling = false;
+                        if (!paused && (cqe->res > 0 || cqe->res == -ENOBUFS || cqe->res == -ECANCELED))
+                            deferred.push_back(make_user_data(OP_RECV, id));
+                        else
+                            connection->recv_armed = false;
+                    }
+                } else if (op == OP_SEND) {
+                    auto found = connections.find(id);
+                    if (found != connections.end()) {
+                        if (cqe->flags & IORING_CQE_F_NOTIF)
+                            found->second->on_notif();
+                        else if (found->second->on_send(cqe->res, more))
+                            deferred.push_back(make_user_data(OP_SEND, id));
+                    }
+                } else if (op == OP_STOP) {
+                    stop = true;
+                }
+            }
+
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+            if (recycled)
+                ring_publish_buffers(ring);
+
+            /*
+             * перезапуски готовим только после того, как очередь завершений
+             * освобождена: тогда ядро может принять накопленные SQE
+             */
+            ring_submit(ring);
+            prepare_deferred();
+            ring_submit(ring);
+        }
+
+        if (stop)
+            return;
+    }
+}
+
+
+stream_socket *uring_server_socket::accept_one_client() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    has_accepted.wait(lock, [this] { return !accepted.empty() || closed || err_msg; });
+
+    if (err_msg) {
+        perror(err_msg);
+        throw std::runtime_error(err_msg);
+    }
+    if (closed)
+        throw std::runtime_error("server socket is closed");
+
+    int client_sk = accepted.front();
+    accepted.pop_front();
+
+    int slot = -1;
+    char *out_buf;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        out_buf = send_slots + slot * SEND_SLOT_SIZE;
+    } else {
+        out_buf = new char[SEND_SLOT_SIZE];
+    }
+
+    uint64_t id = next_id++;
+    uring_connection_socket *connection = new uring_connection_socket(this, id, client_sk, slot, out_buf);
+    connections[id] = connection;
+
+    std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+    prepare_or_defer(make_user_data(OP_RECV, id));
+    ring_submit(ring);
+
+    return connection;
+}
+
+
+void uring_server_socket::release_client(stream_socket *client) {
+    uring_connection_socket *connection = (uring_connection_socket *) client;
+
+    connection->start_send();
+    {
+        std::unique_lock<std::mutex> lock(connection->mtx);
+
+        /*
+         * досылаем буфер, но клиент, который не читает, не должен держать
+         * поток вечно: после таймаута рвём соединение, и отправка завершится
+         * с ошибкой. Освобождать буфер можно, только когда ядро его отпустило
+         */
+        if (!connection->changed.wait_for(lock, std::chrono::milliseconds(RELEASE_SEND_TIMEOUT_MS),
+                                          [connection] { return connection->sent_all() || connection->error; }))
+            ::shutdown(connection->sk, SHUT_RDWR);
+
+        connection->changed.wait(lock, [connection] {
+            return !connection->send_pending && !connection->notifs_pending;
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        connections.erase(connection->id);
+        if (connection->slot >= 0)
+            free_slots.push_back(connection->slot);
+
+        std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+        prepare_or_defer(make_user_data(OP_CANCEL, connection->id));
+        ring_submit(ring);
+    }
+
+    delete connection;
+}
+
+
+void uring_server_socket::close() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (closed)
+        return;
+    closed = true;
+
+    if (sk >= 0) {
+        ::shutdown(sk, SHUT_RDWR);
+        ::close(sk);
+        sk = -1;
+    }
+
+    while (!accepted.empty()) {
+        ::close(accepted.front());
+        accepted.pop_front();
+    }
+
+    for (auto i = connections.begin(); i != connections.end(); ++i)
+        ::shutdown(i->second->sk, SHUT_RDWR);
+
+    has_accepted.notify_all();
+
+    std::cerr << "server socket is closed\n";
+}
+
+
+uring_server_socket::~uring_server_socket() {
+    close();
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> sqLock(ring->sq_mtx);
+            io_uring_sqe *sqe = ring_try_next_sqe(ring);
+            if (sqe) {
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = make_user_data(OP_STOP, 0);
+                ring_submit(ring);
+                break;
+            }
+        }
+        /*
+         * очередь отправки полна, ждём, пока поток завершений её освободит
+         */
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    reaper.join();
+
+    for (auto i = connections.begin(); i != connections.end(); ++i)
+        delete i->second;
+
+    ring_destroy(ring);
+    munmap(recv_buffers, RECV_BUFFERS * RECV_BUFFER_SIZE);
+    munmap(send_slots, SEND_SLOTS * SEND_SLOT_SIZE);
+}
+
+
+/*
+ * uring_connection_socket implementation
+ */
+
+uring_connection_socket::uring_connection_socket(uring_server_socket *owner, uint64_t id, int sk, int slot,
+                                                 char *out_buf)
+        : owner(owner), id(id), sk(sk), slot(slot), out_buf(out_buf) {}
+
+
+bool uring_connection_socket::on_recv(const char *data, int res) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (res > 0) {
+        inbound.insert(inbound.end(), data, data + res);
+        update_charge();
+    } else if (res == 0) {
+        eof = true;
+    } else if (res != -ENOBUFS && res != -ECANCELED) {
+        error = -res;
+    }
+
+    /*
+     * если читатель ждёт больше, чем верхняя граница, останавливаться нельзя
+     */
+    if (inbound.size() - inbound_pos > std::max(uring_server_socket::RECV_HIGH_WATERMARK, wanted))
+        recv_paused = true;
+
+    changed.notify_all();
+    return recv_paused;
+}
+
+
+/*
+ * mtx must be held
+ */
+void uring_connection_socket::update_charge() {
+    buffer_accounting *accounting = owner->accounting;
+    if (!accounting || inbound.capacity() == charged)
+        return;
+
+    if (inbound.capacity() > charged)
+        accounting->charge(inbound.capacity() - charged);
+    else
+        accounting->release(charged - inbound.capacity());
+    charged = inbound.capacity();
+}
+
+
+bool uring_connection_socket::on_send(int res, bool more) {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (more)
+        ++notifs_pending;
+
+    bool resend = false;
+    if (send_zero_copy && (res == -EINVAL || res == -EOPNOTSUPP)) {
+        owner->zero_copy = false;
+        resend = true;
+    } else if (res <= 0) {
+        error = res ? -res : EPIPE;
+    } else {
+        out_sent += res;
+        resend = out_sent < out_len;
+    }
+
+    send_pending = resend;
+    changed.notify_all();
+    return resend;
+}
+
+
+void uring_connection_socket::on_notif() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (notifs_pending)
+        --notifs_pending;
+    changed.notify_all();
+}
+
+
+/*
+ * copies what fits into the buffer, mtx must be held
+ */
+size_t uring_connection_socket::append(const char *data, size_t size) {
+    if (error)
+        throw std::runtime_error("can't send all data");
+
+    if (out_sent && !send_pending && !notifs_pending) {
+        memmove(out_buf, out_buf + out_sent, out_len - out_sent);
+        out_len -= out_sent;
+        out_sent = 0;
+    }
+
+    size_t chunk = std::min(size, uring_server_socket::SEND_SLOT_SIZE - out_len);
+    memcpy(out_buf + out_len, data, chunk);
+    out_len += chunk;
+
+    return chunk;
+}
+
+
+/*
+ * mtx must be held
+ */
+bool uring_connection_socket::writable() const {
+    return error || out_len < uring_server_socket::SEND_SLOT_SIZE
+           || (out_sent && !send_pending && !notifs_pending);
+}
+
+
+/*
+ * mtx must be held
+ */
+bool uring_connection_socket::sent_all() const {
+    return !send_pending && out_sent == out_len;
+}
+
+
+/*
+ * sends the buffer unless a send is already pending: then the reaper
+ * sends the new data after it; mtx mustn't be held
+ */
+void uring_connection_socket::start_send() {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (send_pending || error || out_sent == out_len)
+            return;
+        send_pending = true;
+    }
+
+    owner->submit_send(this);
+}
+
+
+void uring_connection_socket::flush() {
+    start_send();
+
+    std::unique_lock<std::mutex> lock(mtx);
+    changed.wait(lock, [this] { return sent_all() || error; });
+
+    if (error)
+        throw std::runtime_error("can't send all data");
+}
+
+
+void uring_connection_socket::send(const void *buf, size_t size) {
+    const char *data = (const char *) buf;
+
+    while (size) {
+        size_t chunk;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            chunk = append(data, size);
+        }
+        data += chunk;
+        size -= chunk;
+
+        if (size) {
+            start_send();
+
+            std::unique_lock<std::mutex> lock(mtx);
+            changed.wait(lock, [this] { return writable(); });
+        }
+    }
+}
+
+
+size_t uring_connection_socket::send_nonblocking(const void *buf, size_t size) {
+    size_t chunk;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        chunk = append((const char *) buf, size);
+    }
+
+    start_send();
+    return chunk;
+}
+
+
+bool uring_connection_socket::wait_writable(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mtx);
+    return changed.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return writable(); });
+}
+
+
+void uring_connection_socket::recv(void *buf, size_t size) {
+    start_send();
+
+    bool resume = false;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+
+        wanted = size;
+        if (recv_paused && inbound.size() - inbound_pos < size) {
+            recv_paused = false;
+            lock.unlock();
+            owner->resume_recv(this);
+            lock.lock();
+        }
+
+        changed.wait(lock, [this, size] { return inbound.size() - inbound_pos >= size || eof || error; });
+        wanted = 0;
+
+        if (inbound.size() - inbound_pos < size)
+            throw std::runtime_error("can't receive all data");
+
+        memcpy(buf, inbound.data() + inbound_pos, size);
+        inbound_pos += size;
+
+        if (inbound_pos == inbound.size()) {
+            inbound.clear();
+            inbound_pos = 0;
+            /*
+             * после больших запросов не держим память под очередь
+             */
+            if (inbound.capacity() > uring_server_socket::RECV_HIGH_WATERMARK)
+                std::vector<char>().swap(inbound);
+        } else if (inbound_pos >= uring_server_socket::RECV_BUFFER_SIZE) {
+            inbound.erase(inbound.begin(), inbound.begin() + inbound_pos);
+            inbound_pos = 0;
+        }
+        update_charge();
+
+        if (recv_paused && inbound.size() - inbound_pos < uring_server_socket::RECV_LOW_WATERMARK) {
+            recv_paused = false;
+            resume = true;
+        }
+    }
+
+    if (resume)
+        owner->resume_recv(this);
+}
+
+
+uring_connection_socket::~uring_connection_socket() {
+    if (owner->accounting)
+        owner->accounting->release(charged);
+    ::shutdown(sk, SHUT_RDWR);
+    ::close(sk);
+    if (slot < 0)
+        delete[] out_buf;
+}
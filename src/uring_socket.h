@@ -0,0 +1,201 @@
+#pragma once
+
+#include "stream_socket.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <thread>
+#include <vector>
+
+/*
+ * stream_socket implementation on top of io_uring (Linux 6.0+).
+ *
+ * Every server socket owns a ring and a thread reaping its completions.
+ * Connections are accepted by a single multishot accept, incoming data
+ * arrives through a multishot recv into a ring of provided buffers and is
+ * copied into a per-connection queue, so recv doesn't make a syscall while
+ * the queue has enough data. When more than RECV_HIGH_WATERMARK bytes
+ * are queued the recv is stopped until the reader takes the queue below
+ * RECV_LOW_WATERMARK, so a peer can't make the server buffer without
+ * bound what nobody reads. Outgoing data is collected in a registered
+ * buffer and sent with one zero-copy send when the connection starts
+ * waiting for input or the buffer is full. Neither waits for the send to
+ * complete: the reaper sends the rest after a short send, and data
+ * appended meanwhile goes out with it. send_nonblocking takes what fits
+ * into the buffer, wait_writable waits for the running send. SQEs
+ * prepared by the reaper and by the connections are submitted together
+ * by one io_uring_enter.
+ *
+ * Because of the buffering send doesn't report errors immediately,
+ * they are thrown by the next send or recv.
+ *
+ * Only the server side is served by io_uring: a client has one
+ * connection per shard with one request in flight, so there is
+ * nothing to batch and it stays on tcp_client_socket.
+ */
+
+struct uring_ring;
+class uring_connection_socket;
+
+class uring_server_socket : public stream_server_socket {
+    const static unsigned RING_ENTRIES = 1024;
+    const static unsigned RECV_BUFFERS = 512;
+    const static size_t RECV_BUFFER_SIZE = 4096;
+    const static unsigned SEND_SLOTS = 128;
+    const static size_t SEND_SLOT_SIZE = 16384;
+    const static size_t RECV_HIGH_WATERMARK = 256 * 1024;
+    const static size_t RECV_LOW_WATERMARK = 64 * 1024;
+    const static int RELEASE_SEND_TIMEOUT_MS = 1000;
+
+    int sk = -1;
+    const char *err_msg = nullptr;
+    sockaddr_in ipv4addr;
+    bool closed = false;
+    std::atomic<bool> zero_copy;
+
+    uring_ring *ring = nullptr;
+    std::thread reaper;
+
+    /*
+     * guards the accepted queue, the connections table and free send slots,
+     * taken before the mutex of any connection
+     */
+    std::mutex mtx;
+    std::condition_variable has_accepted;
+    std::deque<int> accepted;
+    std::map<uint64_t, uring_connection_socket *> connections;
+    uint64_t next_id = 1;
+
+    char *recv_buffers = nullptr;
+    char *send_slots = nullptr;
+    std::vector<int> free_slots;
+
+    /*
+     * user_data of accepts, recvs, sends and cancels which didn't get an SQE
+     * because the submission queue was full, they are prepared again
+     * after the next completions are reaped; guarded by mtx and sq_mtx
+     */
+    std::vector<uint64_t> deferred;
+
+    buffer_accounting *accounting = nullptr;
+
+    void reap();
+
+    static void reap_wrapper(uring_server_socket *self) {
+        self->reap();
+    }
+
+    bool prepare(uint64_t user_data);
+
+    void prepare_or_defer(uint64_t user_data);
+
+    void prepare_deferred();
+
+    void resume_recv(uring_connection_socket *connection);
+
+    void submit_send(uring_connection_socket *connection);
+
+    void fail(const char *msg);
+
+    friend class uring_connection_socket;
+
+public:
+    uring_server_socket(const char *addr, uint16_t port, int backlog, bool reuse_port = false);
+
+    stream_socket *accept_one_client() override;
+
+    void release_client(stream_socket *client) override;
+
+    void set_buffer_accounting(buffer_accounting *accounting) override {
+        this->accounting = accounting;
+    }
+
+    void close() override;
+
+    ~uring_server_socket() override;
+};
+
+
+class uring_connection_socket : public stream_socket {
+    uring_server_socket *owner;
+    uint64_t id;
+    int sk;
+
+    std::mutex mtx;
+    std::condition_variable changed;
+    std::vector<char> inbound;
+    size_t inbound_pos = 0;
+    bool eof = false;
+    int error = 0;
+    /*
+     * recv_paused and the size recv waits for are guarded by mtx,
+     * recv_armed and recv_cancelling by the owner's mtx
+     */
+    bool recv_paused = false;
+    size_t wanted = 0;
+    bool recv_armed = true;
+    bool recv_cancelling = false;
+    size_t charged = 0;
+
+    /*
+     * out_buf holds out_len bytes, the first out_sent of them are sent;
+     * guarded by mtx. While a send is pending the reaper keeps sending
+     * up to out_len, the buffer is compacted only when the kernel
+     * doesn't use it: no send is pending and every zero-copy send
+     * has got its notification.
+     */
+    int slot;
+    char *out_buf;
+    size_t out_len = 0;
+    size_t out_sent = 0;
+
+    bool send_pending = false;
+    bool send_zero_copy = false;
+    unsigned notifs_pending = 0;
+
+    uring_connection_socket(uring_server_socket *owner, uint64_t id, int sk, int slot, char *out_buf);
+
+    size_t append(const char *data, size_t size);
+
+    bool writable() const;
+
+    bool sent_all() const;
+
+    void start_send();
+
+    /*
+     * Returns true if the recv has to be stopped.
+     */
+    bool on_recv(const char *data, int res);
+
+    void update_charge();
+
+    /*
+     * Returns true if the rest of the buffer has to be sent.
+     */
+    bool on_send(int res, bool more);
+
+    void on_notif();
+
+    friend class uring_server_socket;
+
+public:
+    void send(const void *buf, size_t size) override;
+
+    void recv(void *buf, size_t size) override;
+
+    size_t send_nonblocking(const void *buf, size_t size) override;
+
+    bool wait_writable(int timeout_ms) override;
+
+    void flush() override;
+
+    ~uring_connection_socket() override;
+};
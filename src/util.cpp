@@ -3,6 +3,10 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <cstring>
+#include <stdexcept>
+#include <cerrno>
+#include <sys/socket.h>
+#include <poll.h>
 #include "stream_socket.h"
 #include "util.h"
 
@@ -19,6 +23,70 @@ void init_ipv4addr(const char *addr, tcp_port port, sockaddr_in &ipv4addr) {
 }
 
 
+bool fd_send_all(int fd, const void *buf, size_t size) {
+    const char *data = (const char *) buf;
+
+    while (size) {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+
+bool fd_recv_all(int fd, void *buf, size_t size) {
+    char *data = (char *) buf;
+
+    while (size) {
+        ssize_t received = ::recv(fd, data, size, MSG_WAITALL);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+
+ssize_t fd_send_nonblocking(int fd, const void *buf, size_t size) {
+    while (true) {
+        ssize_t sent = ::send(fd, buf, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent >= 0)
+            return sent;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        return -1;
+    }
+}
+
+
+bool fd_wait_writable(int fd, int timeout_ms) {
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR);
+
+    /*
+     * ошибки сокета тоже считаем готовностью,
+     * следующая отправка их и обнаружит
+     */
+    return ready != 0;
+}
+
+
 void send_string(std::string &str, stream_socket *sk) {
     uint32_t t32;
 
@@ -31,16 +99,59 @@ void send_string(std::string &str, stream_socket *sk) {
 }
 
 
+void send_string(const char *str, size_t len, stream_socket *sk) {
+    uint32_t t32 = htonl((uint32_t) (len + 1));
+    sk->send(&t32, sizeof(t32));
+
+    sk->send(str, len);
+    sk->send("", 1);
+}
+
+
+decode_limits &get_decode_limits() {
+    static decode_limits limits;
+    return limits;
+}
+
+
+static void check_decode_size(uint32_t size, uint32_t limit, const char *what) {
+    if (size > limit)
+        throw message_too_large(std::string(what) + " of " + std::to_string(size) + " exceeds the limit of "
+                                + std::to_string(limit));
+}
+
+
+void check_string_size(uint32_t size) {
+    check_decode_size(size, get_decode_limits().max_string, "string");
+}
+
+
+void check_list_size(uint32_t size) {
+    check_decode_size(size, get_decode_limits().max_list, "list");
+}
+
+
+void check_frame_size(uint32_t size) {
+    check_decode_size(size, get_decode_limits().max_frame, "frame");
+}
+
+
 std::string recv_string(stream_socket *sk) {
     uint32_t t32;
 
     sk->recv(&t32, sizeof(t32));
     uint32_t descriptionLen = ntohl(t32);
+    check_string_size(descriptionLen);
 
-    std::unique_ptr<char> buf(new char[descriptionLen]);
-    sk->recv(buf.get(), descriptionLen);
+    std::string str(descriptionLen, '\0');
+    if (descriptionLen)
+        sk->recv(&str[0], descriptionLen);
 
-    return std::string(buf.get());
+    /*
+     * длина включает завершающий ноль, строка кончается на первом нуле
+     */
+    str.resize(strlen(str.c_str()));
+    return str;
 }
 
 
@@ -56,6 +167,20 @@ void recv_uint(uint32_t &x, stream_socket *sk) {
 }
 
 
+void send_uint64(uint64_t x, stream_socket *sk) {
+    send_uint((uint32_t) (x >> 32), sk);
+    send_uint((uint32_t) x, sk);
+}
+
+
+void recv_uint64(uint64_t &x, stream_socket *sk) {
+    uint32_t high, low;
+    recv_uint(high, sk);
+    recv_uint(low, sk);
+    x = ((uint64_t) high << 32) | low;
+}
+
+
 void send_bool(bool x, stream_socket *sk) {
     uint8_t t8 = (uint8_t) x;
     sk->send(&t8, sizeof(t8));
@@ -67,3 +192,66 @@ void recv_bool(bool &x, stream_socket *sk) {
     sk->recv(&t8, sizeof(t8));
     x = t8;
 }
+
+
+void send_varint(uint32_t x, stream_socket *sk) {
+    uint8_t buf[5];
+    size_t len = 0;
+
+    while (x >= 0x80) {
+        buf[len++] = (uint8_t) (x | 0x80);
+        x >>= 7;
+    }
+    buf[len++] = (uint8_t) x;
+
+    sk->send(buf, len);
+}
+
+
+void recv_varint(uint32_t &x, stream_socket *sk) {
+    uint8_t t8;
+    x = 0;
+
+    for (int shift = 0; shift < 35; shift += 7) {
+        sk->recv(&t8, sizeof(t8));
+        x |= (uint32_t) (t8 & 0x7f) << shift;
+        if (!(t8 & 0x80))
+            return;
+    }
+
+    throw std::runtime_error("malformed varint");
+}
+
+
+uint32_t zigzag_encode(int32_t x) {
+    return ((uint32_t) x << 1) ^ (uint32_t) (x >> 31);
+}
+
+
+int32_t zigzag_decode(uint32_t x) {
+    return (int32_t) ((x >> 1) ^ -(x & 1));
+}
+
+
+void send_compact_string(const std::string &str, stream_socket *sk) {
+    send_compact_string(str.data(), str.length(), sk);
+}
+
+
+void send_compact_string(const char *str, size_t len, stream_socket *sk) {
+    send_varint((uint32_t) len, sk);
+    sk->send(str, len);
+}
+
+
+std::string recv_compact_string(stream_socket *sk) {
+    uint32_t len;
+    recv_varint(len, sk);
+    check_string_size(len);
+
+    std::string str(len, '\0');
+    if (len)
+        sk->recv(&str[0], len);
+
+    return str;
+}
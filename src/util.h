@@ -2,18 +2,94 @@
 
 #include "stream_socket.h"
 #include <string>
+#include <stdexcept>
 #include <arpa/inet.h>
 
 void init_ipv4addr(const char *addr, tcp_port port, sockaddr_in &ipv4addr);
 
+/*
+ * Blocking send/recv on a descriptor repeated until all the data is transferred,
+ * return false on error or if the peer has closed the connection.
+ */
+bool fd_send_all(int fd, const void *buf, size_t size);
+
+bool fd_recv_all(int fd, void *buf, size_t size);
+
+/*
+ * Sends what the descriptor takes without blocking,
+ * returns the number of bytes sent or -1 on error.
+ */
+ssize_t fd_send_nonblocking(int fd, const void *buf, size_t size);
+
+bool fd_wait_writable(int fd, int timeout_ms);
+
+/*
+ * Bounds on what a peer can make us allocate while decoding:
+ * the length of a string, the number of elements of a list and the
+ * size of a frame, before or after decompression. Decoding a message
+ * over them throws message_too_large. Set before any connection is made.
+ */
+struct decode_limits {
+    uint32_t max_string = 1 << 20;
+    uint32_t max_list = 1 << 22;
+    uint32_t max_frame = 1 << 28;
+};
+
+decode_limits &get_decode_limits();
+
+class message_too_large : public std::runtime_error {
+public:
+    explicit message_too_large(const std::string &what) : std::runtime_error(what) {}
+};
+
+void check_string_size(uint32_t size);
+
+void check_list_size(uint32_t size);
+
+void check_frame_size(uint32_t size);
+
 void send_string(std::string &str, stream_socket *sk);
 
+void send_string(const char *str, size_t len, stream_socket *sk);
+
 std::string recv_string(stream_socket *sk);
 
 void send_uint(uint32_t x, stream_socket *sk);
 
 void recv_uint(uint32_t &x, stream_socket *sk);
 
+/*
+ * 64-bit value as two uints, the high one first.
+ */
+void send_uint64(uint64_t x, stream_socket *sk);
+
+void recv_uint64(uint64_t &x, stream_socket *sk);
+
 void send_bool(bool x, stream_socket *sk);
 
-void recv_bool(bool &x, stream_socket *sk);
\ No newline at end of file
+void recv_bool(bool &x, stream_socket *sk);
+
+/*
+ * LEB128 varints: 7 bits per byte starting from the lowest ones,
+ * the high bit is set on every byte except the last.
+ */
+void send_varint(uint32_t x, stream_socket *sk);
+
+void recv_varint(uint32_t &x, stream_socket *sk);
+
+/*
+ * Maps signed deltas to unsigned values so that small negative
+ * numbers stay small: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+ */
+uint32_t zigzag_encode(int32_t x);
+
+int32_t zigzag_decode(uint32_t x);
+
+/*
+ * String as a varint length followed by the characters, without the trailing zero.
+ */
+void send_compact_string(const std::string &str, stream_socket *sk);
+
+void send_compact_string(const char *str, size_t len, stream_socket *sk);
+
+std::string recv_compact_string(stream_socket *sk);